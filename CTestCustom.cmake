@@ -1,3 +1 @@
-CTestCustom.cmake
-￼
-￼
+# Custom settings for ctest, copied to the build directory by CMakeLists.txt
@@ -0,0 +1,165 @@
+/**
+ * @file    mergeBenchmark.cpp
+ * @brief   heap merge against radix merge of the seed hits of query fragments,
+ *          by number of hits, to tune fixed::radix_merge_min_points
+ *
+ * Indexes a FASTA file as wfmash does, sketches every fragment of its
+ * sequences against the index and times both merges of the seed hits of the
+ * fragments in each bucket of hit counts. Self hits are kept.
+ *
+ * Usage: merge-benchmark [FASTA (data/LPA.subset.fa.gz)] [percent identity (80)] [runs (5)]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "map/include/map_parameters.hpp"
+#include "map/include/commonFunc.hpp"
+#include "map/include/winSketch.hpp"
+#include "map/include/seedMerge.hpp"
+#include "map/include/sequenceIds.hpp"
+#include "common/seqiter.hpp"
+
+using namespace skch;
+
+namespace
+{
+  /**
+   * @brief   best of runs, in nanoseconds per interval point
+   */
+  template <typename F>
+    double bestPerPoint(int runs, uint64_t points, F f)
+    {
+      double best = 0;
+      for (int r = 0; r < runs; r++)
+      {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / points;
+        best = r == 0 ? ns : std::min(best, ns);
+      }
+      return best;
+    }
+}
+
+int main(int argc, char** argv)
+{
+  const std::string fasta = argc > 1 ? argv[1] : "data/LPA.subset.fa.gz";
+  const float identity = argc > 2 ? std::atof(argv[2]) / 100 : 0.80;
+  const int runs = argc > 3 ? std::atoi(argv[3]) : 5;
+
+  //Mapping defaults of wfmash for -p, with the sketch size of parse_args
+  Parameters param{};
+  param.kmerSize = 15;
+  param.segLength = 1000;
+  param.alphabetSize = 4;
+  param.percentageIdentity = identity;
+  param.threads = 1;
+  param.refSequences = {fasta};
+  param.querySequences = {fasta};
+  param.sketchSize = 0.02 * (1 + (1 - identity) / 0.05) * (param.segLength - param.kmerSize);
+
+  SequenceIdManager idManager({fasta}, {fasta}, {}, {}, "#");
+  Sketch sketch(param, idManager, idManager.getTargetSequenceNames());
+  const PosListIndex& lookupIndex = sketch.minmerPosLookupIndex;
+
+  //Seed slices of every fragment, bucketed by their number of interval points
+  constexpr size_t BUCKETS = 24;
+  std::vector<std::vector<std::vector<SeedSlice>>> buckets(BUCKETS);
+  std::vector<uint64_t> bucketPoints(BUCKETS, 0);
+  std::vector<MinmerInfo> minmers;
+  seqiter::for_each_seq_in_file(fasta, idManager.getQuerySequenceNames(),
+      [&](const std::string& name, const std::string& seq) {
+        std::string s = seq;
+        CommonFunc::makeUpperCaseAndValidDNA(&s[0], s.length());
+        seqno_t seqId = idManager.getSequenceId(name);
+        for (offset_t start = 0; start + param.segLength <= offset_t(s.length()); start += param.segLength)
+        {
+          minmers.clear();
+          CommonFunc::sketchSequence(minmers, &s[start], param.segLength, param.kmerSize, param.alphabetSize,
+                                     param.kmerHash, param.sketchSize, seqId);
+          std::vector<SeedSlice> slices;
+          uint64_t points = 0;
+          for (const auto& mi : minmers)
+          {
+            const auto found = lookupIndex.find(mi.hash);
+            if (found.first != found.second)
+            {
+              slices.push_back(SeedSlice {found.first, found.second, mi.hash});
+              points += found.second - found.first;
+            }
+          }
+          if (points == 0)
+            continue;
+          size_t b = 0;
+          while ((uint64_t(2) << b) <= points && b + 1 < BUCKETS)
+            b++;
+          buckets[b].push_back(std::move(slices));
+          bucketPoints[b] += points;
+        }
+      });
+
+  std::cout << "points\tfragments\theap (ns/point)\tradix (ns/point)\toutput" << std::endl;
+  std::vector<IntervalPoint> heapPoints, radixPoints;
+  auto toHeap = [&](const IntervalPoint& ip) { heapPoints.push_back(ip); };
+  auto toRadix = [&](const IntervalPoint& ip) { radixPoints.push_back(ip); };
+  bool identical = true;
+  for (size_t b = 0; b < BUCKETS; b++)
+  {
+    if (buckets[b].empty())
+      continue;
+
+    std::vector<SeedSlice> slices;
+    double nsHeap = bestPerPoint(runs, bucketPoints[b], [&]() {
+        for (const auto& fragment : buckets[b])
+        {
+          heapPoints.clear();
+          slices = fragment;
+          heapMergeSeedSlices(slices, toHeap);
+        }
+    });
+    double nsRadix = bestPerPoint(runs, bucketPoints[b], [&]() {
+        for (const auto& fragment : buckets[b])
+        {
+          radixPoints.clear();
+          slices = fragment;
+          radixMergeSeedSlices(slices, toRadix);
+        }
+    });
+
+    bool same = true;
+    for (const auto& fragment : buckets[b])
+    {
+      heapPoints.clear();
+      radixPoints.clear();
+      slices = fragment;
+      heapMergeSeedSlices(slices, toHeap);
+      slices = fragment;
+      radixMergeSeedSlices(slices, toRadix);
+      //The heap emits equal points in any order of their hashes
+      same = same && std::is_sorted(heapPoints.begin(), heapPoints.end())
+             && std::is_sorted(radixPoints.begin(), radixPoints.end());
+      auto byHash = [](const IntervalPoint& a, const IntervalPoint& b) {
+        return std::tie(a.seqId, a.pos, a.side, a.hash) < std::tie(b.seqId, b.pos, b.side, b.hash);
+      };
+      std::sort(heapPoints.begin(), heapPoints.end(), byHash);
+      std::sort(radixPoints.begin(), radixPoints.end(), byHash);
+      same = same && heapPoints.size() == radixPoints.size()
+             && std::equal(heapPoints.begin(), heapPoints.end(), radixPoints.begin(),
+                           [&](const IntervalPoint& a, const IntervalPoint& b) { return !byHash(a, b) && !byHash(b, a); });
+    }
+    identical = identical && same;
+
+    std::cout << (uint64_t(1) << b) << "-" << (uint64_t(2) << b) - 1 << "\t" << buckets[b].size()
+              << std::fixed << std::setprecision(1) << "\t" << nsHeap << "\t" << nsRadix
+              << "\t" << (same ? "identical" : "DIFFER") << std::endl;
+  }
+  std::cout << "radix_merge_min_points = " << fixed::radix_merge_min_points << std::endl;
+  return identical ? 0 : 1;
+}
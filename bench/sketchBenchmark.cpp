@@ -0,0 +1,187 @@
+/**
+ * @file    sketchBenchmark.cpp
+ * @brief   per-fragment cost of bottom-s sketching: the unordered_dense map
+ *          and heap selection that sketchSequence used before BottomSketch,
+ *          against BottomSketch, and the whole sketchSequence call
+ *
+ * Usage: sketch-benchmark [genome bp (20000000)] [runs (5)]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "map/include/base_types.hpp"
+#include "map/include/commonFunc.hpp"
+#include "map/include/bottomSketch.hpp"
+
+using namespace skch;
+
+namespace
+{
+  struct KmerHit
+  {
+    hash_t hash;
+    strand_t strand;
+  };
+
+  /**
+   * @brief   canonical rolling hashes of every k-mer of a fragment, as sketchSequence computes them
+   */
+  std::vector<KmerHit> hashFragment(const char* seq, offset_t len, int kmerSize)
+  {
+    std::vector<KmerHit> hits;
+    CommonFunc::RollingKmerHash rollingHash(kmerSize);
+    for (offset_t i = 0; i < kmerSize - 1; i++)
+      rollingHash.push(seq[i]);
+    for (offset_t i = 0; i < len - kmerSize + 1; i++)
+    {
+      rollingHash.push(seq[i + kmerSize - 1]);
+      hash_t hashFwd = rollingHash.forward();
+      hash_t hashBwd = rollingHash.reverse();
+      if (hashFwd != hashBwd)
+        hits.push_back(KmerHit{std::min(hashFwd, hashBwd), hashFwd < hashBwd ? strnd::FWD : strnd::REV});
+    }
+    return hits;
+  }
+
+  /**
+   * @brief   the selection of sketchSequence before BottomSketch, kept as the reference
+   */
+  void selectWithMap(const std::vector<KmerHit>& hits, size_t sketchSize, std::vector<MinmerInfo>& minmerIndex)
+  {
+    ankerl::unordered_dense::map<hash_t, MinmerInfo> sketched_vals;
+    std::vector<hash_t> sketched_heap;
+    sketched_heap.reserve(sketchSize+1);
+
+    for (offset_t i = 0; i < offset_t(hits.size()); i++)
+    {
+      hash_t currentKmer = hits[i].hash;
+      strand_t currentStrand = hits[i].strand;
+      if (sketched_heap.size() < sketchSize || currentKmer <= sketched_heap.front())
+      {
+        if (sketched_heap.empty() || sketched_vals.find(currentKmer) == sketched_vals.end())
+        {
+          if (sketched_vals.size() < sketchSize || currentKmer < sketched_heap.front())
+          {
+            sketched_vals[currentKmer] = MinmerInfo{currentKmer, i, i, 0, currentStrand};
+            sketched_heap.push_back(currentKmer);
+            std::push_heap(sketched_heap.begin(), sketched_heap.end());
+          }
+          if (sketched_vals.size() > sketchSize)
+          {
+            sketched_vals.erase(sketched_heap[0]);
+            std::pop_heap(sketched_heap.begin(), sketched_heap.end());
+            sketched_heap.pop_back();
+          }
+        }
+        else
+        {
+          sketched_vals[currentKmer].wpos_end = i;
+          sketched_vals[currentKmer].strand += currentStrand == strnd::FWD ? 1 : -1;
+        }
+      }
+    }
+
+    minmerIndex.resize(sketched_heap.size());
+    for (auto rev_it = minmerIndex.rbegin(); rev_it != minmerIndex.rend(); rev_it++)
+    {
+      *rev_it = (std::move(sketched_vals[sketched_heap.front()]));
+      (*rev_it).strand = (*rev_it).strand > 0 ? strnd::FWD : ((*rev_it).strand == 0 ? strnd::AMBIG : strnd::REV);
+      std::pop_heap(sketched_heap.begin(), sketched_heap.end());
+      sketched_heap.pop_back();
+    }
+  }
+
+  void selectWithBottomSketch(const std::vector<KmerHit>& hits, size_t sketchSize, std::vector<MinmerInfo>& minmerIndex)
+  {
+    static BottomSketch sketched;
+    sketched.reset(sketchSize);
+    for (offset_t i = 0; i < offset_t(hits.size()); i++)
+      sketched.add(hits[i].hash, i, 0, hits[i].strand);
+    sketched.extract(minmerIndex);
+  }
+
+  uint64_t checksum(const std::vector<MinmerInfo>& minmerIndex)
+  {
+    uint64_t sum = 0;
+    for (const auto& mi : minmerIndex)
+      sum = sum * 31 + mi.hash + mi.wpos * 7 + mi.wpos_end * 13 + mi.strand;
+    return sum;
+  }
+
+  /**
+   * @brief   best of runs, in microseconds per fragment
+   */
+  template <typename F>
+    double bestPerFragment(int runs, size_t fragments, F f)
+    {
+      double best = 0;
+      for (int r = 0; r < runs; r++)
+      {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count() / fragments;
+        best = r == 0 ? us : std::min(best, us);
+      }
+      return best;
+    }
+}
+
+int main(int argc, char** argv)
+{
+  const offset_t genomeLength = argc > 1 ? std::atoll(argv[1]) : 20000000;
+  const int runs = argc > 2 ? std::atoi(argv[2]) : 5;
+  const int kmerSize = 15;
+
+  std::mt19937_64 rng(42);
+  std::string genome(genomeLength, 'A');
+  for (auto& c : genome)
+    c = "ACGT"[rng() & 3];
+
+  std::cout << "fragment\ts\tmap+heap (us)\tBottomSketch (us)\tsketchSequence (us)\tchecksums" << std::endl;
+  for (offset_t fragmentLength : {1000, 5000})
+  {
+    const size_t sketchSize = fragmentLength / 40;
+    const size_t fragments = genomeLength / fragmentLength;
+
+    std::vector<std::vector<KmerHit>> hits(fragments);
+    for (size_t f = 0; f < fragments; f++)
+      hits[f] = hashFragment(genome.data() + f * fragmentLength, fragmentLength, kmerSize);
+
+    std::vector<MinmerInfo> minmerIndex;
+    uint64_t sumMap = 0, sumBottom = 0;
+    double usMap = bestPerFragment(runs, fragments, [&]() {
+        sumMap = 0;
+        for (const auto& h : hits)
+        {
+          selectWithMap(h, sketchSize, minmerIndex);
+          sumMap += checksum(minmerIndex);
+        }
+    });
+    double usBottom = bestPerFragment(runs, fragments, [&]() {
+        sumBottom = 0;
+        for (const auto& h : hits)
+        {
+          selectWithBottomSketch(h, sketchSize, minmerIndex);
+          sumBottom += checksum(minmerIndex);
+        }
+    });
+    double usWhole = bestPerFragment(runs, fragments, [&]() {
+        for (size_t f = 0; f < fragments; f++)
+          CommonFunc::sketchSequence(minmerIndex, &genome[f * fragmentLength], fragmentLength,
+                                     kmerSize, 4, KmerHash::ROLLING_2BIT, sketchSize, 0);
+    });
+
+    std::cout << fragmentLength << "\t" << sketchSize << std::fixed << std::setprecision(1)
+              << "\t" << usMap << "\t" << usBottom << "\t" << usWhole
+              << "\t" << (sumMap == sumBottom ? "identical" : "DIFFER") << std::endl;
+    if (sumMap != sumBottom)
+      return 1;
+  }
+  return 0;
+}
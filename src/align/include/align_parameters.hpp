@@ -62,6 +62,9 @@ struct Parameters {
     bool sam_format;                              //Emit the output in SAM format (PAF default)
     bool no_seq_in_sam;                           //Do not fill the SEQ field in SAM format
     bool multithread_fasta_input;                 //Multithreaded fasta input
+    bool ordered_output;                          //Write alignments in the order of the input mappings
+    uint64_t scheduling_window;                   //Upcoming mappings reordered by expected alignment cost (0 = input order);
+                                                  //with ordered_output, about as many alignments wait to be written
 
 #ifdef WFA_PNG_TSV_TIMING
     // plotting
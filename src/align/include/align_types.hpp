@@ -26,6 +26,8 @@ namespace align
     skch::offset_t rEndPos;             //mapping boundary end offset on ref
     skch::strand_t strand;              //mapping strand
     float mashmap_estimated_identity;
+    uint64_t inputRank;                 //position of the mapping in the input, to restore the output order
+    uint64_t alignmentCost;             //expected cost of aligning the mapping, for scheduling and progress
   };
 
   typedef std::unordered_map <std::string, std::string> refSequenceMap_t;
@@ -16,6 +16,10 @@
 #include <cassert>
 #include <thread>
 #include <memory>
+#include <functional>
+#include <queue>
+#include <map>
+#include <mutex>
 #include <htslib/faidx.h>
 
 //Own includes
@@ -23,9 +27,14 @@
 #include "align/include/align_parameters.hpp"
 #include "map/include/base_types.hpp"
 #include "map/include/commonFunc.hpp"
+#include "map/include/binaryMappings.hpp"
+#include "map/include/sequenceIds.hpp"
+#include "map/include/blockingQueue.hpp"
+#include "map/include/threadBudget.hpp"
 
 //External includes
 #include "common/wflign/src/wflign.hpp"
+#include "common/wflign/src/record_writer.hpp"
 #include "common/atomic_queue/atomic_queue.h"
 #include "common/seqiter.hpp"
 #include "common/progress.hpp"
@@ -46,7 +55,6 @@ long double float2phred(long double prob) {
 
 struct seq_record_t {
     MappingBoundaryRow currentRecord;
-    std::string mappingRecordLine;
     std::string refSequence;  
     std::string querySequence;
     uint64_t refStartPos;
@@ -56,11 +64,10 @@ struct seq_record_t {
     uint64_t queryLen;
     uint64_t queryTotalLength;
 
-    seq_record_t(const MappingBoundaryRow& c, const std::string& r, 
+    seq_record_t(const MappingBoundaryRow& c,
                  const std::string& ref, uint64_t refStart, uint64_t refLength, uint64_t refTotalLength,
                  const std::string& query, uint64_t queryStart, uint64_t queryLength, uint64_t queryTotalLength)
         : currentRecord(c)
-        , mappingRecordLine(r)
         , refSequence(ref)
         , querySequence(query)
         , refStartPos(refStart)
@@ -90,7 +97,15 @@ struct seq_record_t {
 typedef atomic_queue::AtomicQueue<seq_record_t*, 1024, nullptr, true, true, false, false> seq_atomic_queue_t;
 
 /**
- * @brief A multi-producer, single-consumer (MPSC) atomic queue for storing pointers to std::string objects.
+ * @brief The PAF/SAM output of one mapping, with the input rank of the mapping.
+ */
+struct paf_output_t {
+    uint64_t rank;
+    std::string* output;
+};
+
+/**
+ * @brief A multi-producer, single-consumer (MPSC) atomic queue for storing paf_output_t objects.
  *
  * This queue is designed for a setup where there are multiple producers and a single consumer.
  * Multiple producers enqueue pointers to std::string objects, which represent PAF (Pairwise Alignment Format) strings.
@@ -98,13 +113,22 @@ typedef atomic_queue::AtomicQueue<seq_record_t*, 1024, nullptr, true, true, fals
  *
  * The queue has the following characteristics:
  * - Capacity: 1024 elements
- * - Default value for empty elements: nullptr
+ * - Non-atomic elements (AtomicQueue2), as they carry the rank along with the string
  * - MINIMIZE_CONTENTION: true (minimizes contention among producers)
  * - MAXIMIZE_THROUGHPUT: true (optimized for high throughput)
  * - TOTAL_ORDER: false (relaxed memory ordering for better performance)
  * - SPSC: false (multi-producer, single-consumer mode)
  */
-typedef atomic_queue::AtomicQueue<std::string*, 1024, nullptr, true, true, false, false> paf_atomic_queue_t;
+typedef atomic_queue::AtomicQueue2<paf_output_t, 1024, true, true, false, false> paf_atomic_queue_t;
+
+/**
+ * @brief A bounded blocking queue of the mappings waiting for their sequences.
+ *
+ * The reader, which may run on the threads of the mapper, waits while the
+ * queue is full and the processors wait while it is empty, instead of polling.
+ * The reader closes the queue once every mapping has been pushed.
+ */
+typedef skch::BlockingQueue<MappingBoundaryRow*> row_queue_t;
 
 
   /**
@@ -122,8 +146,22 @@ typedef atomic_queue::AtomicQueue<std::string*, 1024, nullptr, true, true, false
       faidx_t* ref_faidx;
       faidx_t* query_faidx;
 
+      //output strings passed from the workers to the writer and back
+      wflign::RecordBufferPool output_buffers;
+
+      //size of the input mapping file and bytes of it read so far, for the progress estimate
+      uint64_t input_bytes = 0;
+      uint64_t input_bytes_read = 0;
+
+      //permits shared with the source of the mappings, held by the workers while they align
+      skch::ThreadBudget* thread_budget = nullptr;
+
     public:
 
+      //Source of mappings: calls its argument once for every mapping to align
+      typedef std::function<void(MappingBoundaryRow&)> MappingRowFn_t;
+      typedef std::function<void(const MappingRowFn_t&)> MappingSourceFn_t;
+
       explicit Aligner(const align::Parameters &p) : param(p) {
           assert(param.refSequences.size() == 1);
           assert(param.querySequences.size() == 1);
@@ -137,11 +175,33 @@ typedef atomic_queue::AtomicQueue<std::string*, 1024, nullptr, true, true, false
       }
       
       /**
-       * @brief                 compute alignments
+       * @brief                 compute alignments of the mappings in the input mapping file
        */
       void compute()
       {
-        this->computeAlignments();
+        // Not a regular file (e.g. a pipe): the progress covers the mappings read so far
+        std::error_code ec;
+        input_bytes = fs::file_size(param.mashmapPafFile, ec);
+        if (ec) {
+            input_bytes = 0;
+        }
+
+        this->computeAlignments([this](const MappingRowFn_t& f) {
+            forEachMappingRow(param.mashmapPafFile, f, &input_bytes_read);
+        });
+      }
+
+      /**
+       * @brief                 compute alignments of mappings produced while aligning
+       * @param[in]   source    runs in the reader thread; the function it is given may be
+       *                        called from several threads at once
+       * @param[in]   budget    optional permits shared with the threads of the source
+       */
+      void compute(const MappingSourceFn_t& source, skch::ThreadBudget* budget = nullptr)
+      {
+        thread_budget = budget;
+        this->computeAlignments(source);
+        thread_budget = nullptr;
       }
 
       /**
@@ -182,10 +242,109 @@ typedef atomic_queue::AtomicQueue<std::string*, 1024, nullptr, true, true, false
           }
       }
 
+      /**
+       * @brief       call f(MappingBoundaryRow&) for every mapping of a PAF or binary mapping file
+       * @param[in]   input_file
+       * @param[in]   f
+       * @param[out]  bytes_read    optional, bytes of the file consumed up to the current mapping
+       */
+      template <typename F>
+      static void forEachMappingRow(const std::string& input_file, F f, uint64_t* bytes_read = nullptr) {
+          MappingBoundaryRow currentRecord;
+
+          // One stream for the format check and the records, as the input may be a pipe
+          std::ifstream mappingListStream(input_file, std::ios::binary);
+          if (!mappingListStream.is_open()) {
+              throw std::runtime_error("[wfmash::align] Error! Failed to open input mapping file: " + input_file);
+          }
+          std::string head;
+          if (skch::BinaryMappings::readMagic(mappingListStream, head)) {
+              skch::BinaryMappings reader;
+              reader.open(std::move(mappingListStream), input_file);
+              skch::BinaryMappingRecord r;
+              uint64_t n = 0;
+              while (reader.next(r)) {
+                  if (bytes_read) {
+                      *bytes_read = reader.dataOffset + ++n * sizeof(skch::BinaryMappingRecord);
+                  }
+                  currentRecord.qId = reader.names[r.querySeqId];
+                  currentRecord.qStartPos = r.queryStartPos;
+                  currentRecord.qEndPos = r.queryEndPos;
+                  currentRecord.strand = r.strand;
+                  currentRecord.refId = reader.names[r.refSeqId];
+                  currentRecord.rStartPos = r.refStartPos;
+                  currentRecord.rEndPos = r.refEndPos;
+                  currentRecord.mashmap_estimated_identity = r.nucIdentity;
+                  f(currentRecord);
+              }
+              return;
+          }
+
+          auto parseLine = [&](const std::string& mappingRecordLine) {
+              if (bytes_read) {
+                  *bytes_read += mappingRecordLine.size() + 1;
+              }
+              if (!mappingRecordLine.empty()) {
+                  parseMashmapRow(mappingRecordLine, currentRecord);
+                  f(currentRecord);
+              }
+          };
+
+          // The bytes read for the format check start the PAF text
+          size_t lineStart = 0;
+          for (size_t lineEnd; (lineEnd = head.find('\n', lineStart)) != std::string::npos; lineStart = lineEnd + 1) {
+              parseLine(head.substr(lineStart, lineEnd - lineStart));
+          }
+          std::string partial = head.substr(lineStart);
+
+          std::string mappingRecordLine;
+          while (std::getline(mappingListStream, mappingRecordLine)) {
+              if (!partial.empty()) {
+                  mappingRecordLine.insert(0, partial);
+                  partial.clear();
+              }
+              parseLine(mappingRecordLine);
+          }
+          if (!partial.empty()) {
+              parseLine(partial);
+          }
+      }
+
+      /**
+       * @brief       expected cost of aligning a mapping
+       * @details     The mapped length weighted by the estimated divergence, the model of
+       *              scripts/split_approx_mappings_in_chunks.py. The divergence is floored at
+       *              1%, since aligning identical sequences still takes time in their length.
+       * @param[in]   currentRecord
+       */
+      inline static uint64_t expectedAlignmentCost(const MappingBoundaryRow& currentRecord) {
+          const uint64_t length = std::max(currentRecord.qEndPos - currentRecord.qStartPos,
+                                           currentRecord.rEndPos - currentRecord.rStartPos);
+          const double divergence = std::max(1.0 - currentRecord.mashmap_estimated_identity, 0.01);
+          return std::max<uint64_t>(1, length * divergence);
+      }
+
+      /**
+       * @brief       convert a final mapping of the mapper
+       * @param[in]   e
+       * @param[in]   idManager     sequence names of the mapper
+       * @param[out]  currentRecord
+       */
+      inline static void mappingResultToRow(const skch::MappingResult& e, const skch::SequenceIdManager& idManager,
+                                            MappingBoundaryRow& currentRecord) {
+          currentRecord.qId = idManager.getSequenceName(e.querySeqId);
+          currentRecord.qStartPos = e.queryStartPos;
+          currentRecord.qEndPos = e.queryEndPos;
+          currentRecord.strand = e.strand;
+          currentRecord.refId = idManager.getSequenceName(e.refSeqId);
+          currentRecord.rStartPos = e.refStartPos;
+          currentRecord.rEndPos = e.refEndPos;
+          currentRecord.mashmap_estimated_identity = e.nucIdentity;
+      }
+
   private:
 
 seq_record_t* createSeqRecord(const MappingBoundaryRow& currentRecord, 
-                              const std::string& mappingRecordLine,
                               faidx_t* ref_faidx,
                               faidx_t* query_faidx) {
     // Get the reference sequence length
@@ -211,7 +370,7 @@ seq_record_t* createSeqRecord(const MappingBoundaryRow& currentRecord,
                                         currentRecord.qStartPos, currentRecord.qEndPos - 1, &query_len);
 
     // Create a new seq_record_t object for the alignment
-    seq_record_t* rec = new seq_record_t(currentRecord, mappingRecordLine,
+    seq_record_t* rec = new seq_record_t(currentRecord,
                                          std::string(ref_seq, ref_len), 
                                          currentRecord.rStartPos - head_padding, ref_len, ref_size,
                                          std::string(query_seq, query_len), 
@@ -224,7 +383,7 @@ seq_record_t* createSeqRecord(const MappingBoundaryRow& currentRecord,
     return rec;
 }
 
-std::string processAlignment(seq_record_t* rec) {
+void processAlignment(seq_record_t* rec, std::string& output) {
     std::string& ref_seq = rec->refSequence;
     std::string& query_seq = rec->querySequence;
 
@@ -251,7 +410,7 @@ std::string processAlignment(seq_record_t* rec) {
     wfa_penalties.gap_opening2 = param.wfa_patching_gap_opening_score2;
     wfa_penalties.gap_extension2 = param.wfa_patching_gap_extension_score2;
 
-    std::stringstream output;
+    wflign::RecordWriter record(output);
 
     // Do direct biWFA alignment
     wflign::wavefront::do_biwfa_alignment(
@@ -266,7 +425,7 @@ std::string processAlignment(seq_record_t* rec) {
         rec->refTotalLength,
         rec->currentRecord.rStartPos,
         rec->currentRecord.rEndPos - rec->currentRecord.rStartPos,
-        output,
+        record,
         wfa_penalties,
         param.emit_md_tag,
         !param.sam_format,
@@ -274,63 +433,98 @@ std::string processAlignment(seq_record_t* rec) {
         param.min_identity,
         param.wflign_max_len_minor,
         rec->currentRecord.mashmap_estimated_identity);
-
-    return output.str();
 }
 
-void single_reader_thread(const std::string& input_file,
-                          atomic_queue::AtomicQueue<std::string*, 1024>& line_queue,
-                          std::atomic<bool>& reader_done) {
-    std::ifstream mappingListStream(input_file);
-    if (!mappingListStream.is_open()) {
-        throw std::runtime_error("[wfmash::align] Error! Failed to open input mapping file: " + input_file);
-    }
+void single_reader_thread(const MappingSourceFn_t& source,
+                          row_queue_t& row_queue,
+                          std::atomic<bool>& reader_done,
+                          progress_meter::ProgressMeter& progress) {
+    // The progress counts expected alignment cost
+    std::atomic<uint64_t> queued_cost(0);
+
+    // Upcoming mappings, the most expensive one on top
+    auto cheaper = [](const MappingBoundaryRow* a, const MappingBoundaryRow* b) {
+        return a->alignmentCost < b->alignmentCost;
+    };
+    std::priority_queue<MappingBoundaryRow*, std::vector<MappingBoundaryRow*>, decltype(cheaper)> window(cheaper);
+    std::mutex window_mutex;
+    uint64_t next_rank = 0;
+
+    source([&](MappingBoundaryRow& row) {
+        row.alignmentCost = expectedAlignmentCost(row);
+
+        // Extrapolate the total from the part of the input file read so far,
+        // or count the mappings seen so far when the input size is unknown
+        const uint64_t queued = queued_cost.fetch_add(row.alignmentCost, std::memory_order_relaxed) + row.alignmentCost;
+        if (input_bytes > 0 && input_bytes_read > 0) {
+            progress.total.store(std::max<uint64_t>(queued, (long double)queued * input_bytes / input_bytes_read),
+                                 std::memory_order_relaxed);
+        } else {
+            progress.total.fetch_add(row.alignmentCost, std::memory_order_relaxed);
+        }
 
-    std::string line;
-    while (std::getline(mappingListStream, line)) {
-        if (!line.empty()) {
-            std::string* line_ptr = new std::string(std::move(line));
-            line_queue.push(line_ptr);
+        // Mappings are held back only while the processors have work queued.
+        // They are pushed outside the lock: the push waits while the queue is
+        // full, and the other producers must still be able to add to the window
+        thread_local std::vector<MappingBoundaryRow*> ready;
+        {
+            std::lock_guard<std::mutex> lock(window_mutex);
+            row.inputRank = next_rank++;
+            window.push(new MappingBoundaryRow(std::move(row)));
+            while (window.size() > param.scheduling_window) {
+                ready.push_back(window.top());
+                window.pop();
+            }
+            if (ready.empty() && !window.empty() && row_queue.size() == 0) {
+                ready.push_back(window.top());
+                window.pop();
+            }
         }
+        for (MappingBoundaryRow* row_ptr : ready) {
+            row_queue.push(row_ptr);
+        }
+        ready.clear();
+    });
+
+    while (!window.empty()) {
+        row_queue.push(window.top());
+        window.pop();
     }
+    row_queue.close();
 
-    mappingListStream.close();
+    // The whole input has been seen, the total is now exact
+    progress.total.store(queued_cost.load());
     reader_done.store(true);
 }
 
 void processor_thread(std::atomic<size_t>& total_alignments_queued,
-                      std::atomic<bool>& reader_done,
-                      atomic_queue::AtomicQueue<std::string*, 1024>& line_queue,
+                      row_queue_t& row_queue,
                       seq_atomic_queue_t& seq_queue,
                       std::atomic<bool>& thread_should_exit) {
     faidx_t* local_ref_faidx = fai_load(param.refSequences.front().c_str());
     faidx_t* local_query_faidx = fai_load(param.querySequences.front().c_str());
 
     while (!thread_should_exit.load()) {
-        std::string* line_ptr = nullptr;
-        if (line_queue.try_pop(line_ptr)) {
-            MappingBoundaryRow currentRecord;
-            parseMashmapRow(*line_ptr, currentRecord);
-            
-            // Process the record and create seq_record_t
-            seq_record_t* rec = createSeqRecord(currentRecord, *line_ptr, local_ref_faidx, local_query_faidx);
-
-            while (!seq_queue.try_push(rec)) {
-                if (thread_should_exit.load()) {
-                    delete rec;
-                    delete line_ptr;
-                    goto cleanup;
-                }
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            }
-
-            ++total_alignments_queued;
-            delete line_ptr;
-        } else if (reader_done.load() && line_queue.was_empty()) {
+        // Waits for the next mapping, fails once the reader is done and the queue drained
+        MappingBoundaryRow* row_ptr = nullptr;
+        if (!row_queue.pop(row_ptr)) {
             break;
-        } else {
+        }
+
+        // Process the record and create seq_record_t
+        seq_record_t* rec = createSeqRecord(*row_ptr, local_ref_faidx, local_query_faidx);
+
+        while (!seq_queue.try_push(rec)) {
+            if (thread_should_exit.load()) {
+                delete rec;
+                delete row_ptr;
+                goto cleanup;
+            }
             std::this_thread::sleep_for(std::chrono::milliseconds(10));
         }
+
+        ++total_alignments_queued;
+        delete row_ptr;
     }
 
 cleanup:
@@ -339,7 +533,7 @@ cleanup:
 }
 
 void processor_manager(seq_atomic_queue_t& seq_queue,
-                       atomic_queue::AtomicQueue<std::string*, 1024>& line_queue,
+                       row_queue_t& row_queue,
                        std::atomic<size_t>& total_alignments_queued,
                        std::atomic<bool>& reader_done,
                        std::atomic<bool>& processor_done,
@@ -353,8 +547,8 @@ void processor_manager(seq_atomic_queue_t& seq_queue,
 
     auto spawn_processor = [&](size_t id) {
         thread_should_exit[id].store(false);
-        processor_threads.emplace_back([this, &total_alignments_queued, &reader_done, &line_queue, &seq_queue, &thread_should_exit, id]() {
-            this->processor_thread(total_alignments_queued, reader_done, line_queue, seq_queue, thread_should_exit[id]);
+        processor_threads.emplace_back([this, &total_alignments_queued, &row_queue, &seq_queue, &thread_should_exit, id]() {
+            this->processor_thread(total_alignments_queued, row_queue, seq_queue, thread_should_exit[id]);
         });
     };
 
@@ -363,7 +557,7 @@ void processor_manager(seq_atomic_queue_t& seq_queue,
     size_t current_processors = 1;
     uint64_t exhausted = 0;
 
-    while (!reader_done.load() || !line_queue.was_empty() || !seq_queue.was_empty()) {
+    while (!reader_done.load() || row_queue.size() != 0 || !seq_queue.was_empty()) {
         size_t queue_size = seq_queue.was_size();
 
         if (param.multithread_fasta_input) {
@@ -407,14 +601,18 @@ void worker_thread(uint64_t tid,
         seq_record_t* rec = nullptr;
         if (seq_queue.try_pop(rec)) {
             is_working.store(true);
-            std::string alignment_output = processAlignment(rec);
+            std::string* alignment_output = output_buffers.get();
+            {
+                skch::ThreadBudget::Permit permit(thread_budget);
+                processAlignment(rec, *alignment_output);
+            }
             
             // Push the alignment output to the paf_queue
-            paf_queue.push(new std::string(std::move(alignment_output)));
+            paf_queue.push(paf_output_t{rec->currentRecord.inputRank, alignment_output});
             
             // Update progress meter and processed alignment length
             uint64_t alignment_length = rec->currentRecord.qEndPos - rec->currentRecord.qStartPos;
-            progress.increment(alignment_length);
+            progress.increment(rec->currentRecord.alignmentCost);
             processed_alignment_length.fetch_add(alignment_length, std::memory_order_relaxed);
             
             delete rec;
@@ -476,12 +674,28 @@ void writer_thread(const std::string& output_file,
                            [](const std::atomic<bool>& w) { return !w.load(); });
     };
 
+    auto write_output = [&](std::string* output) {
+        outstream.write(output->data(), output->size());
+        output_buffers.put(output);
+    };
+
+    // Outputs that arrived ahead of their turn, when the input order is kept
+    std::map<uint64_t, std::string*> pending;
+    uint64_t next_rank = 0;
+
     while (true) {
-        std::string* paf_output = nullptr;
+        paf_output_t paf_output;
         if (paf_queue.try_pop(paf_output)) {
-            outstream << *paf_output;
-            outstream.flush();
-            delete paf_output;
+            if (!param.ordered_output) {
+                write_output(paf_output.output);
+                continue;
+            }
+            pending.emplace(paf_output.rank, paf_output.output);
+            while (!pending.empty() && pending.begin()->first == next_rank) {
+                write_output(pending.begin()->second);
+                pending.erase(pending.begin());
+                ++next_rank;
+            }
         } else if (reader_done.load() && processor_done.load() && paf_queue.was_empty() && all_workers_done()) {
             break;
         } else {
@@ -489,39 +703,28 @@ void writer_thread(const std::string& output_file,
         }
     }
 
+    for (auto& p : pending) {
+        write_output(p.second);
+    }
+
     outstream.close();
 }
 
-void computeAlignments() {
+void computeAlignments(const MappingSourceFn_t& source) {
     std::atomic<size_t> total_alignments_queued(0);
     std::atomic<bool> reader_done(false);
     std::atomic<bool> processor_done(false);
 
     // Create queues
-    atomic_queue::AtomicQueue<std::string*, 1024> line_queue;
+    row_queue_t row_queue(1024);
     seq_atomic_queue_t seq_queue;
     paf_atomic_queue_t paf_queue;  // Add this line
 
     // Calculate max_processors based on the number of worker threads
     size_t max_processors = std::max(1UL, static_cast<unsigned long>(param.threads));
 
-    // Calculate total alignment length
-    uint64_t total_alignment_length = 0;
-    {
-        std::ifstream mappingListStream(param.mashmapPafFile);
-        std::string mappingRecordLine;
-        MappingBoundaryRow currentRecord;
-
-        while(std::getline(mappingListStream, mappingRecordLine)) {
-            if (!mappingRecordLine.empty()) {
-                parseMashmapRow(mappingRecordLine, currentRecord);
-                total_alignment_length += currentRecord.qEndPos - currentRecord.qStartPos;
-            }
-        }
-    }
-
-    // Create progress meter
-    progress_meter::ProgressMeter progress(total_alignment_length, "[wfmash::align] aligned");
+    // Create progress meter, its total is set by the reader
+    progress_meter::ProgressMeter progress(0, "[wfmash::align] aligned");
 
     // Create atomic counter for processed alignment length
     std::atomic<uint64_t> processed_alignment_length(0);
@@ -530,13 +733,13 @@ void computeAlignments() {
     auto start_time = std::chrono::high_resolution_clock::now();
 
     // Launch single reader thread
-    std::thread single_reader([this, &line_queue, &reader_done]() {
-        this->single_reader_thread(param.mashmapPafFile, line_queue, reader_done);
+    std::thread single_reader([this, &source, &row_queue, &reader_done, &progress]() {
+        this->single_reader_thread(source, row_queue, reader_done, progress);
     });
 
     // Launch processor manager
-    std::thread processor_manager_thread([this, &seq_queue, &line_queue, &total_alignments_queued, &reader_done, &processor_done, max_processors]() {
-        this->processor_manager(seq_queue, line_queue, total_alignments_queued, reader_done, processor_done, max_processors);
+    std::thread processor_manager_thread([this, &seq_queue, &row_queue, &total_alignments_queued, &reader_done, &processor_done, max_processors]() {
+        this->processor_manager(seq_queue, row_queue, total_alignments_queued, reader_done, processor_done, max_processors);
     });
 
     // Launch worker threads
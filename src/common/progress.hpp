@@ -36,7 +36,8 @@ public:
                 auto time_since_update = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_update).count();
                 uint64_t current_completed = completed.load(std::memory_order_relaxed);
                 
-                if (time_since_update >= update_interval && 
+                // A total still being counted may start at zero
+                if (time_since_update >= update_interval && total > 0 &&
                     (current_completed - last_completed >= min_progress_for_update ||
                      current_completed >= total)) {
                     do_print();
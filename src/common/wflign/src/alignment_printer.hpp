@@ -4,10 +4,59 @@
 #include <string>
 #include <sstream>
 #include "wflign.hpp"
+#include "record_writer.hpp"
 
 namespace wflign {
 namespace wavefront {
 
+void write_tag_and_md_string(
+    RecordWriter &out,
+    const char *cigar_ops,
+    const int cigar_start,
+    const int cigar_end,
+    const int target_start,
+    const char *target,
+    const int64_t target_offset,
+    const int64_t target_pointer_shift);
+
+void write_alignment_sam(
+    RecordWriter &out,
+    const alignment_t& patch_aln,
+    const std::string& query_name,
+    const uint64_t& query_total_length,
+    const uint64_t& query_offset,
+    const uint64_t& query_length,
+    const bool& query_is_rev,
+    const std::string& target_name,
+    const uint64_t& target_total_length,
+    const uint64_t& target_offset,
+    const uint64_t& target_length,
+    const float& min_identity,
+    const float& mashmap_estimated_identity,
+    const bool& no_seq_in_sam,
+    const bool& emit_md_tag,
+    const char* query,
+    const char* target,
+    const int64_t& target_pointer_shift);
+
+bool write_alignment_paf(
+    RecordWriter& out,
+    const alignment_t& aln,
+    const std::string& query_name,
+    const uint64_t& query_total_length,
+    const uint64_t& query_offset,
+    const uint64_t& query_length,
+    const bool& query_is_rev,
+    const std::string& target_name,
+    const uint64_t& target_total_length,
+    const uint64_t& target_offset,
+    const uint64_t& target_length,
+    const float& min_identity,
+    const float& mashmap_estimated_identity,
+    const bool& with_endline = true,
+    const bool& is_rev_patch = false);
+
+// Same records, written to a stream
 void write_tag_and_md_string(
     std::ostream &out,
     const char *cigar_ops,
@@ -0,0 +1,131 @@
+#ifndef RECORD_WRITER_HPP_
+#define RECORD_WRITER_HPP_
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Namespaces
+ */
+namespace wflign {
+
+/*
+ * Appends the fields of PAF/SAM records to a string
+ *
+ * The interface mirrors the operator<< calls of a std::ostream and produces
+ * the same bytes: integers in decimal, floating point numbers like the
+ * default stream format (%g, 6 significant digits), and char-sized integers
+ * as characters. Integers are formatted with std::to_chars and floating
+ * point numbers with snprintf("%g"), without stream state, and the target
+ * string keeps its capacity between records. Floating point std::to_chars
+ * would need GCC 11.
+ */
+class RecordWriter {
+public:
+    explicit RecordWriter(std::string& out) : out(out) {}
+
+    RecordWriter& operator<<(const char c) {
+        out.push_back(c);
+        return *this;
+    }
+
+    RecordWriter& operator<<(const char* s) {
+        out.append(s);
+        return *this;
+    }
+
+    RecordWriter& operator<<(const std::string& s) {
+        out.append(s);
+        return *this;
+    }
+
+    RecordWriter& operator<<(const std::string_view s) {
+        out.append(s.data(), s.size());
+        return *this;
+    }
+
+    template <typename T,
+              typename std::enable_if<std::is_integral<T>::value && sizeof(T) != 1, int>::type = 0>
+    RecordWriter& operator<<(const T value) {
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, res.ptr - buf);
+        return *this;
+    }
+
+    RecordWriter& operator<<(const float value) { return general("%g", double(value)); }
+    RecordWriter& operator<<(const double value) { return general("%g", value); }
+    RecordWriter& operator<<(const long double value) { return general("%Lg", value); }
+
+    void append(const char* s, const size_t n) {
+        out.append(s, n);
+    }
+
+private:
+    std::string& out;
+
+    template <typename T>
+    RecordWriter& general(const char* format, const T value) {
+        char buf[48];
+        const int n = std::snprintf(buf, sizeof(buf), format, value);
+        out.append(buf, n);
+        return *this;
+    }
+};
+
+/*
+ * Strings that carry formatted records from the formatting threads to the
+ * writer thread and back, so that steady-state output does not allocate
+ */
+class RecordBufferPool {
+public:
+    RecordBufferPool() = default;
+    RecordBufferPool(const RecordBufferPool&) = delete;
+    RecordBufferPool& operator=(const RecordBufferPool&) = delete;
+
+    ~RecordBufferPool() {
+        for (auto* buf : free) {
+            delete buf;
+        }
+    }
+
+    // An empty buffer, recycled if one is available
+    std::string* get() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free.empty()) {
+                std::string* buf = free.back();
+                free.pop_back();
+                return buf;
+            }
+        }
+        return new std::string();
+    }
+
+    // Return a written-out buffer; unusually large ones are released
+    void put(std::string* buf) {
+        if (buf->capacity() > max_kept_capacity) {
+            delete buf;
+            return;
+        }
+        buf->clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        free.push_back(buf);
+    }
+
+private:
+    static constexpr size_t max_kept_capacity = 1 << 22;
+
+    std::mutex mutex;
+    std::vector<std::string*> free;
+};
+
+} // namespace wflign
+
+#endif
@@ -27,7 +27,7 @@ void do_biwfa_alignment(
     const uint64_t target_total_length,
     const uint64_t target_offset,
     const uint64_t target_length,
-    std::ostream& out,
+    RecordWriter& out,
     const wflign_penalties_t& penalties,
     const bool emit_md_tag,
     const bool paf_format_else_sam,
@@ -106,6 +106,37 @@ void do_biwfa_alignment(
     }
 }
 
+void do_biwfa_alignment(
+    const std::string& query_name,
+    char* const query,
+    const uint64_t query_total_length,
+    const uint64_t query_offset,
+    const uint64_t query_length,
+    const bool query_is_rev,
+    const std::string& target_name,
+    char* const target,
+    const uint64_t target_total_length,
+    const uint64_t target_offset,
+    const uint64_t target_length,
+    std::ostream& out,
+    const wflign_penalties_t& penalties,
+    const bool emit_md_tag,
+    const bool paf_format_else_sam,
+    const bool no_seq_in_sam,
+    const float min_identity,
+    const uint64_t wflign_max_len_minor,
+    const float mashmap_estimated_identity) {
+    thread_local std::string buf;
+    buf.clear();
+    RecordWriter record(buf);
+    do_biwfa_alignment(
+        query_name, query, query_total_length, query_offset, query_length, query_is_rev,
+        target_name, target, target_total_length, target_offset, target_length,
+        record, penalties, emit_md_tag, paf_format_else_sam, no_seq_in_sam,
+        min_identity, wflign_max_len_minor, mashmap_estimated_identity);
+    out.write(buf.data(), buf.size());
+}
+
 /*
 * Configuration
 */
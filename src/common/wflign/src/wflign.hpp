@@ -13,6 +13,7 @@
 #include <fstream>
 
 #include "wflign_alignment.hpp"
+#include "record_writer.hpp"
 
 #include "robin-hood-hashing/robin_hood.h"
 #include "dna.hpp"
@@ -34,6 +35,28 @@
 namespace wflign {
     namespace wavefront {
 
+        void do_biwfa_alignment(
+            const std::string& query_name,
+            char* const query,
+            const uint64_t query_total_length,
+            const uint64_t query_offset,
+            const uint64_t query_length,
+            const bool query_is_rev,
+            const std::string& target_name,
+            char* const target,
+            const uint64_t target_total_length,
+            const uint64_t target_offset,
+            const uint64_t target_length,
+            RecordWriter& out,
+            const wflign_penalties_t& penalties,
+            const bool emit_md_tag,
+            const bool paf_format_else_sam,
+            const bool no_seq_in_sam,
+            const float min_identity,
+            const uint64_t wflign_max_len_minor,
+            const float mashmap_estimated_identity);
+
+        // Same, written to a stream
         void do_biwfa_alignment(
             const std::string& query_name,
             char* const query,
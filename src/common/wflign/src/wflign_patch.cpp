@@ -2078,7 +2078,7 @@ query_start : query_end)
 }
 
 void write_tag_and_md_string(
-    std::ostream &out,
+    RecordWriter &out,
     const char *cigar_ops,
     const int cigar_start,
     const int cigar_end,
@@ -2151,7 +2151,7 @@ void write_tag_and_md_string(
 }
 
 void write_alignment_sam(
-    std::ostream &out,
+    RecordWriter &out,
     const alignment_t& patch_aln,
     const std::string& query_name,
     const uint64_t& query_total_length,
@@ -2208,17 +2208,11 @@ void write_alignment_sam(
 
         if (no_seq_in_sam) {
             out << "*";
+        } else if (patch_aln.is_rev) {
+            // reverse complement
+            out << reverse_complement(std::string(query + patch_aln.j, patch_aln.query_length));
         } else {
-            std::stringstream seq;
-            for (uint64_t p = patch_aln.j; p < patch_aln.j + patch_aln.query_length; ++p) {
-                seq << query[p];
-            }
-            if (patch_aln.is_rev) {
-                // reverse complement
-                out << reverse_complement(seq.str());
-            } else {
-                out << seq.str();
-            }
+            out.append(query + patch_aln.j, patch_aln.query_length);
         }
         out << "\t*\t"
             << "NM:i:" << (patch_mismatches + patch_inserted_bp + patch_deleted_bp) << "\t"
@@ -2242,7 +2236,7 @@ void write_alignment_sam(
 }
 
 bool write_alignment_paf(
-        std::ostream& out,
+        RecordWriter& out,
         const alignment_t& aln,
         const std::string& query_name,
         const uint64_t& query_total_length,
@@ -2310,7 +2304,7 @@ bool write_alignment_paf(
                 //<< "\t" << "bd:i:" << deleted_bp
                 << "cg:Z:" << cigar << "\t";
             if (with_endline) {
-                out << std::endl;
+                out << '\n';
             }
             ret = true;
         }
@@ -2319,6 +2313,85 @@ bool write_alignment_paf(
     return ret;
 }
 
+// Records for a stream are formatted in a per-thread buffer, then written at once
+
+void write_tag_and_md_string(
+    std::ostream &out,
+    const char *cigar_ops,
+    const int cigar_start,
+    const int cigar_end,
+    const int target_start,
+    const char *target,
+    const int64_t target_offset,
+    const int64_t target_pointer_shift) {
+    thread_local std::string buf;
+    buf.clear();
+    RecordWriter record(buf);
+    write_tag_and_md_string(record, cigar_ops, cigar_start, cigar_end, target_start,
+                            target, target_offset, target_pointer_shift);
+    out.write(buf.data(), buf.size());
+}
+
+void write_alignment_sam(
+    std::ostream &out,
+    const alignment_t& patch_aln,
+    const std::string& query_name,
+    const uint64_t& query_total_length,
+    const uint64_t& query_offset,
+    const uint64_t& query_length,
+    const bool& query_is_rev,
+    const std::string& target_name,
+    const uint64_t& target_total_length,
+    const uint64_t& target_offset,
+    const uint64_t& target_length,
+    const float& min_identity,
+    const float& mashmap_estimated_identity,
+    const bool& no_seq_in_sam,
+    const bool& emit_md_tag,
+    const char* query,
+    const char* target,
+    const int64_t& target_pointer_shift) {
+    thread_local std::string buf;
+    buf.clear();
+    RecordWriter record(buf);
+    write_alignment_sam(record, patch_aln, query_name, query_total_length,
+                        query_offset, query_length, query_is_rev,
+                        target_name, target_total_length, target_offset, target_length,
+                        min_identity, mashmap_estimated_identity,
+                        no_seq_in_sam, emit_md_tag, query, target, target_pointer_shift);
+    out.write(buf.data(), buf.size());
+}
+
+bool write_alignment_paf(
+        std::ostream& out,
+        const alignment_t& aln,
+        const std::string& query_name,
+        const uint64_t& query_total_length,
+        const uint64_t& query_offset,
+        const uint64_t& query_length,
+        const bool& query_is_rev,
+        const std::string& target_name,
+        const uint64_t& target_total_length,
+        const uint64_t& target_offset,
+        const uint64_t& target_length,
+        const float& min_identity,
+        const float& mashmap_estimated_identity,
+        const bool& with_endline,
+        const bool& is_rev_patch) {
+    thread_local std::string buf;
+    buf.clear();
+    RecordWriter record(buf);
+    const bool ret = write_alignment_paf(
+            record, aln, query_name, query_total_length, query_offset, query_length, query_is_rev,
+            target_name, target_total_length, target_offset, target_length,
+            min_identity, mashmap_estimated_identity, with_endline, is_rev_patch);
+    out.write(buf.data(), buf.size());
+    if (ret && with_endline) {
+        out.flush();
+    }
+    return ret;
+}
+
 double float2phred(const double& prob) {
     if (prob == 1)
         return 255; // guards against "-0"
@@ -66,16 +66,18 @@ int main(int argc, char** argv) {
           std::cerr << "[wfmash::mashmap] Generated spaced seeds in " << time_spaced_seeds.count() << "s (sensitivity: " << sps.sensitivity << ")" << std::endl;
         }
 
-        //Map the sequences in query file
-        t0 = skch::Time::now();
+        if (!yeet_parameters.stream_mappings) {
+            //Map the sequences in query file
+            t0 = skch::Time::now();
 
-        skch::Map mapper = skch::Map(map_parameters);
+            skch::Map mapper = skch::Map(map_parameters);
 
-        std::chrono::duration<double> timeMapQuery = skch::Time::now() - t0;
-        std::cerr << "[wfmash::mashmap] Mapped query in " << timeMapQuery.count() << "s, results saved to: " << map_parameters.outFileName << std::endl;
+            std::chrono::duration<double> timeMapQuery = skch::Time::now() - t0;
+            std::cerr << "[wfmash::mashmap] Mapped query in " << timeMapQuery.count() << "s, results saved to: " << map_parameters.outFileName << std::endl;
 
-        if (yeet_parameters.approx_mapping) {
-            return 0;
+            if (yeet_parameters.approx_mapping) {
+                return 0;
+            }
         }
      }
 
@@ -87,7 +89,29 @@ int main(int argc, char** argv) {
     std::cerr << "[wfmash::align] time spent loading the reference index: " << timeRefRead.count() << " sec" << std::endl;
 
     //Compute the alignments
-    alignObj.compute();
+    if (yeet_parameters.stream_mappings) {
+        //Map the sequences in query file while aligning the mappings of finished queries.
+        //Mappings reach the aligner once the mapper merges and filters them; from then on
+        //the -t threads are shared between the merge tasks and the alignment workers
+        skch::ThreadBudget thread_budget(align_parameters.threads);
+        alignObj.compute([&](const align::Aligner::MappingRowFn_t& align_row) {
+            auto t0 = skch::Time::now();
+
+            skch::Map mapper = skch::Map(map_parameters, nullptr,
+                [&](const skch::MappingResultsVector_t& mappings, const skch::SequenceIdManager& idManager) {
+                    align::MappingBoundaryRow row;
+                    for (const auto& e : mappings) {
+                        align::Aligner::mappingResultToRow(e, idManager, row);
+                        align_row(row);
+                    }
+                }, &thread_budget);
+
+            std::chrono::duration<double> timeMapQuery = skch::Time::now() - t0;
+            std::cerr << "[wfmash::mashmap] Mapped query in " << timeMapQuery.count() << "s, results streamed to the aligner" << std::endl;
+        }, &thread_budget);
+    } else {
+        alignObj.compute();
+    }
 
     std::chrono::duration<double> timeAlign = skch::Time::now() - t0;
     std::cerr << "[wfmash::align] time spent computing the alignment: " << timeAlign.count() << " sec" << std::endl;
@@ -8,6 +8,8 @@
 #include "map/include/map_parameters.hpp"
 #include "map/include/map_stats.hpp"
 #include "map/include/commonFunc.hpp"
+#include "map/include/binaryMappings.hpp"
+#include "map/include/countMinSketch.hpp"
 
 #include "align/include/align_parameters.hpp"
 
@@ -26,6 +28,7 @@ namespace yeet {
 struct Parameters {
     bool approx_mapping = false;
     bool remapping = false;
+    bool stream_mappings = false;
     //bool align_input_paf = false;
 };
 
@@ -95,6 +98,8 @@ void parse_args(int argc,
     args::ValueFlag<std::string> index_by(indexing_opts, "SIZE", "target batch size for indexing [4G]", {'b', "batch"});
     args::ValueFlag<int64_t> sketch_size(indexing_opts, "INT", "sketch size for MinHash [auto]", {'w', "sketch-size"});
     args::ValueFlag<int> kmer_size(indexing_opts, "INT", "k-mer size [15]", {'k', "kmer-size"});
+    args::Flag murmur_hash(indexing_opts, "", "hash k-mers with MurmurHash3 (as in indexes from older versions)", {"murmur-hash"});
+    args::Flag compact_windows(indexing_opts, "", "store reference windows in compact columns (17 instead of 32 bytes each)", {"compact-windows"});
 
     args::Group mapping_opts(options_group, "Mapping:");
     args::Flag approx_mapping(mapping_opts, "", "output approximate mappings (no alignment)", {'m', "approx-mapping"});
@@ -121,23 +126,32 @@ void parse_args(int argc,
     args::ValueFlag<std::string> hg_filter(mapping_opts, "numer,ani-Δ,conf", "hypergeometric filter params [1.0,0.0,99.9]", {"hg-filter"});
     args::ValueFlag<int> min_hits(mapping_opts, "INT", "minimum number of hits for L1 filtering [auto]", {'H', "l1-hits"});
     args::ValueFlag<double> max_kmer_freq(mapping_opts, "FLOAT", "filter minimizers occurring > FLOAT of total [0.0002]", {'F', "filter-freq"});
+    args::ValueFlag<std::string> filter_freq_mem(mapping_opts, "SIZE", "bound -F counting memory with a count-min sketch of SIZE [exact]", {"filter-freq-mem"});
+    args::ValueFlag<double> map_sparsification(mapping_opts, "FLOAT", "keep this fraction of mappings [1.0]", {"sparsification"});
+    args::Flag sparsify_pairs(mapping_opts, "", "apply --sparsification to (query, target) sequence pairs before mapping", {"sparsify-pairs"});
 
     args::Group alignment_opts(options_group, "Alignment:");
-    args::ValueFlag<std::string> input_mapping(alignment_opts, "FILE", "input PAF file for alignment", {'i', "align-paf"});
+    args::ValueFlag<std::string> input_mapping(alignment_opts, "FILE", "input PAF or binary mapping file for alignment", {'i', "align-paf"});
     args::ValueFlag<std::string> wfa_params(alignment_opts, "vals", 
         "scoring: mismatch, gap1(o,e), gap2(o,e) [6,6,2,26,1]", {'g', "wfa-params"});
+    args::ValueFlag<std::string> schedule_window(alignment_opts, "INT", "align the most expensive of the next INT mappings first; --ordered-output may hold as many alignments in memory [65536]", {"schedule-window"});
 
     args::Group output_opts(options_group, "Output Format:");
     args::Flag sam_format(output_opts, "", "output in SAM format (PAF by default)", {'a', "sam"});
     args::Flag emit_md_tag(output_opts, "", "output MD tag", {'d', "md-tag"});
     args::Flag no_seq_in_sam(output_opts, "", "omit sequence field in SAM output", {'q', "no-seq-sam"});
+    args::Flag ordered_output(output_opts, "", "write alignments in the order of the input mappings", {"ordered-output"});
+    args::Flag binary_mappings(output_opts, "", "write approximate mappings in binary format (with -m)", {"binary-mappings"});
+    args::ValueFlag<std::string> binary_to_paf(output_opts, "FILE", "convert binary mappings in FILE to PAF on stdout", {"binary-to-paf"});
+    args::ValueFlag<std::string> paf_to_binary(output_opts, "FILE", "convert PAF mappings in FILE to binary on stdout", {"paf-to-binary"});
 
 
 
     args::Group system_opts(options_group, "System:");
-    args::ValueFlag<int> thread_count(system_opts, "INT", "number of threads [1]", {'t', "threads"});
+    args::ValueFlag<int> thread_count(system_opts, "INT", "number of threads, shared by mapping and alignment when they overlap [1]", {'t', "threads"});
     args::ValueFlag<std::string> tmp_base(system_opts, "PATH", "base directory for temporary files [pwd]", {'B', "tmp-base"});
     args::Flag keep_temp_files(system_opts, "", "retain temporary files", {'Z', "keep-temp"});
+    args::Flag verbose(system_opts, "", "report pipeline and index statistics for every target subset", {"verbose"});
 
 #ifdef WFA_PNG_TSV_TIMING
     args::Group debugging_opts(parser, "[ Debugging Options ]");
@@ -166,6 +180,16 @@ void parse_args(int argc,
         exit(0);
     }
 
+    if (binary_to_paf) {
+        skch::BinaryMappings::toPaf(args::get(binary_to_paf), std::cout);
+        exit(0);
+    }
+
+    if (paf_to_binary) {
+        skch::BinaryMappings::fromPaf(args::get(paf_to_binary), std::cout);
+        exit(0);
+    }
+
     if (argc==1 || !target_sequence_file) {
         std::cout << parser;
         exit(1);
@@ -236,7 +260,6 @@ void parse_args(int argc,
         }
     }
 
-    args::ValueFlag<double> map_sparsification(parser, "FLOAT", "sparsification factor [1.0]", {"sparsification"});
     if (map_sparsification) {
         if (args::get(map_sparsification) == 1) {
             // overflows
@@ -249,6 +272,7 @@ void parse_args(int argc,
         map_parameters.sparsity_hash_threshold
             = std::numeric_limits<uint64_t>::max();
     }
+    map_parameters.sparsify_pairs = sparsify_pairs;
 
     args::ValueFlag<std::string> wfa_score_params(alignment_opts, "MISMATCH,GAP,EXT", "WFA scoring parameters [2,3,1]", {"wfa-params"});
     if (!args::get(wfa_score_params).empty()) {
@@ -289,6 +313,7 @@ void parse_args(int argc,
     align_parameters.emit_md_tag = args::get(emit_md_tag);
     align_parameters.sam_format = args::get(sam_format);
     align_parameters.no_seq_in_sam = args::get(no_seq_in_sam);
+    align_parameters.ordered_output = args::get(ordered_output);
     args::Flag force_wflign(alignment_opts, "", "force WFlign alignment", {"force-wflign"});
     align_parameters.force_wflign = args::get(force_wflign);
     map_parameters.split = !args::get(no_split);
@@ -407,6 +432,15 @@ void parse_args(int argc,
         map_parameters.kmerSize = 15;
     }
 
+    map_parameters.compactWindows = compact_windows;
+
+    // The rolling 2-bit hash packs a k-mer into 64 bits
+    if (murmur_hash || map_parameters.kmerSize > 32) {
+        map_parameters.kmerHash = skch::KmerHash::MURMUR3;
+    } else {
+        map_parameters.kmerHash = skch::KmerHash::ROLLING_2BIT;
+    }
+
     //if (spaced_seed_params) {
         //const std::string foobar = args::get(spaced_seed_params);
 
@@ -482,11 +516,25 @@ void parse_args(int argc,
         map_parameters.threads = 1;
         align_parameters.threads = 1;
     }
+    map_parameters.verbose = args::get(verbose);
     // disable multi-fasta processing due to the memory inefficiency of samtools faidx readers
     // which require us to duplicate the in-memory indexes of large files for each thread
     // if aligner exhaustion is a problem, we could enable this
     align_parameters.multithread_fasta_input = false;
 
+    // the most expensive of the next mappings are aligned first, so that long
+    // low-identity alignments do not run alone at the end
+    if (schedule_window) {
+        const int64_t w = wfmash::handy_parameter(args::get(schedule_window));
+        if (w < 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --schedule-window must be a number of mappings." << std::endl;
+            exit(1);
+        }
+        align_parameters.scheduling_window = w;
+    } else {
+        align_parameters.scheduling_window = 65536;
+    }
+
     // Compute optimal window size for sketching
     {
         const int64_t ss = sketch_size && args::get(sketch_size) >= 0 ? args::get(sketch_size) : -1;
@@ -588,6 +636,20 @@ void parse_args(int argc,
         map_parameters.max_kmer_freq = 0.0002; // default filter fraction
     }
 
+    if (filter_freq_mem) {
+        const int64_t sketch_bytes = handy_parameter(args::get(filter_freq_mem));
+        if (sketch_bytes <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --filter-freq-mem must be a positive size." << std::endl;
+            exit(1);
+        }
+        if (uint64_t(sketch_bytes) < skch::CountMinSketch::MIN_BYTES) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --filter-freq-mem must be at least "
+                      << skch::CountMinSketch::MIN_BYTES << " bytes." << std::endl;
+            exit(1);
+        }
+        map_parameters.kmer_count_sketch_bytes = sketch_bytes;
+    }
+
     //if (window_minimizers) {
         //map_parameters.world_minimizers = false;
     //} else {
@@ -596,7 +658,7 @@ void parse_args(int argc,
 
     if (read_index || write_index)
     {
-      map_parameters.indexFilename = args::get(read_index);
+      map_parameters.indexFilename = write_index ? args::get(write_index) : args::get(read_index);
     } else {
       map_parameters.indexFilename = "";
     }
@@ -622,8 +684,12 @@ void parse_args(int argc,
 
     if (approx_mapping) {
         map_parameters.outFileName = "/dev/stdout";
+        map_parameters.binaryMappings = binary_mappings;
         yeet_parameters.approx_mapping = true;
     } else {
+        // the mappings only go to the aligner
+        map_parameters.binaryMappings = true;
+
         yeet_parameters.approx_mapping = false;
 
         if (tmp_base) {
@@ -644,6 +710,9 @@ void parse_args(int argc,
             yeet_parameters.remapping = true;
             map_parameters.outFileName = args::get(input_mapping);
             align_parameters.mashmapPafFile = args::get(input_mapping);
+        } else if (map_parameters.filterMode != skch::filter::ONETOONE && !args::get(keep_temp_files)) {
+            // the mappings of each query go straight to the aligner, without a mapping file
+            yeet_parameters.stream_mappings = true;
         } else {
             // make a temporary mapping file
             map_parameters.outFileName = temp_file::create();
@@ -703,7 +772,7 @@ void parse_args(int argc,
     std::cerr << "[wfmash] Filters: " << (map_parameters.skip_self ? "skip-self" : "no-skip-self")
               << ", hg(Δ=" << map_parameters.ANIDiff << ",conf=" << map_parameters.ANIDiffConf << ")"
               << ", mode=" << map_parameters.filterMode << " (1=map,2=1-to-1,3=none)" << std::endl;
-    std::cerr << "[wfmash] Output: " << map_parameters.outFileName << std::endl;
+    std::cerr << "[wfmash] Output: " << (yeet_parameters.stream_mappings ? "streamed to the aligner" : map_parameters.outFileName) << std::endl;
 
     temp_file::set_keep_temp(args::get(keep_temp_files));
 
@@ -0,0 +1,445 @@
+/**
+ * @file    binaryMappings.hpp
+ * @brief   binary interchange format for approximate mappings, read by the
+ *          aligner instead of PAF, and its conversion to and from PAF
+ */
+
+#ifndef SKETCH_BINARY_MAPPINGS_HPP
+#define SKETCH_BINARY_MAPPINGS_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+#include "map/include/map_parameters.hpp"
+#include "map/include/commonFunc.hpp"
+
+//External includes
+#include "common/wflign/src/record_writer.hpp"
+#include "interface/temp_file.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     one mapping, as stored in a binary mapping file
+   * @details   Carries every field of the PAF line written by the mapper, with
+   *            sequences referred to by their id in the file's sequence table.
+   */
+  struct BinaryMappingRecord
+  {
+    offset_t queryStartPos;
+    offset_t queryEndPos;
+    offset_t refStartPos;
+    offset_t refEndPos;
+    offset_t blockLength;
+    offset_t splitMappingId;                //chain id, for files with chain tags
+    double kmerComplexity;
+    seqno_t querySeqId;
+    seqno_t refSeqId;
+    int32_t conservedSketches;
+    float nucIdentity;
+    float jaccard;                          //conserved / total sketches, for files without chain tags
+    strand_t strand;
+    uint16_t padding;
+  };
+
+  static_assert(sizeof(BinaryMappingRecord) == 80, "binary mapping records have a fixed layout");
+
+  /**
+   * @class     skch::BinaryMappings
+   * @brief     reading and writing binary mapping files
+   * @details   A file starts with a header: magic number, version, flags and a
+   *            table of sequence names and lengths, indexed by sequence id. The
+   *            fixed size records follow until the end of the file, in the order
+   *            they were written, so files can be produced as a stream.
+   */
+  class BinaryMappings
+  {
+    public:
+
+      static constexpr uint64_t MAGIC = 0x5350414d42414d57;  //"WMABMAPS"
+      static constexpr uint32_t VERSION = 1;
+
+      static constexpr uint32_t FLAG_CHAIN_TAGS = 1;        //records carry chain ids (chain:i:) rather than jc:f:
+
+      uint32_t flags = 0;
+      std::vector<std::string> names;        //sequence id -> name
+      std::vector<offset_t> lengths;         //sequence id -> length
+      uint64_t dataOffset = 0;               //file offset of the first record
+
+    private:
+
+      std::ifstream in;
+      std::vector<BinaryMappingRecord> buffer;
+      size_t bufferPos = 0;
+
+      template <typename T>
+        static void put(std::ostream& out, const T& value)
+        {
+          out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+      template <typename T>
+        static void get(std::istream& in, T& value)
+        {
+          in.read(reinterpret_cast<char*>(&value), sizeof(value));
+        }
+
+      /**
+       * @brief     read the header after the magic number; counts its bytes, as
+       *            the stream may not report positions
+       */
+      void readHeader(const std::string& filename)
+      {
+        uint32_t version = 0;
+        get(in, version);
+        if (!in || version != VERSION)
+        {
+          std::cerr << "[wfmash] Error: " << filename << " is not a binary mapping file of version " << VERSION << std::endl;
+          exit(1);
+        }
+        get(in, flags);
+        uint64_t count = 0;
+        get(in, count);
+        dataOffset = sizeof(MAGIC) + sizeof(version) + sizeof(flags) + sizeof(count);
+        names.resize(count);
+        lengths.resize(count);
+        for (uint64_t i = 0; i < count; i++)
+        {
+          uint32_t nameLength = 0;
+          get(in, nameLength);
+          names[i].resize(nameLength);
+          in.read(&names[i][0], nameLength);
+          get(in, lengths[i]);
+          dataOffset += sizeof(nameLength) + nameLength + sizeof(lengths[i]);
+        }
+        if (!in)
+        {
+          std::cerr << "[wfmash] Error: truncated header in binary mapping file " << filename << std::endl;
+          exit(1);
+        }
+        buffer.resize(4096);
+        buffer.clear();
+        bufferPos = 0;
+      }
+
+    public:
+
+      /**
+       * @brief     read the start of a stream and check whether it is the binary
+       *            mapping magic number
+       * @param[out] head     the bytes read, at most the size of the magic number,
+       *                      which start the text of any other input
+       */
+      static bool readMagic(std::istream& in, std::string& head)
+      {
+        uint64_t magic = 0;
+        head.resize(sizeof(magic));
+        in.read(&head[0], head.size());
+        head.resize(in.gcount());
+        if (head.size() != sizeof(magic))
+          return false;
+        std::memcpy(&magic, head.data(), sizeof(magic));
+        return magic == MAGIC;
+      }
+
+      /**
+       * @brief     write the header of a binary mapping file
+       */
+      static void writeHeader(std::ostream& out, uint32_t flags,
+                              const std::vector<std::string>& names, const std::vector<offset_t>& lengths)
+      {
+        put(out, MAGIC);
+        put(out, VERSION);
+        put(out, flags);
+        put(out, static_cast<uint64_t>(names.size()));
+        for (size_t i = 0; i < names.size(); i++)
+        {
+          put(out, static_cast<uint32_t>(names[i].size()));
+          out.write(names[i].data(), names[i].size());
+          put(out, lengths[i]);
+        }
+      }
+
+      static BinaryMappingRecord encode(const MappingResult& e)
+      {
+        BinaryMappingRecord r;
+        std::memset(&r, 0, sizeof(r));
+        r.queryStartPos = e.queryStartPos;
+        r.queryEndPos = e.queryEndPos;
+        r.refStartPos = e.refStartPos;
+        r.refEndPos = e.refEndPos;
+        r.blockLength = e.blockLength;
+        r.splitMappingId = e.splitMappingId;
+        r.kmerComplexity = e.kmerComplexity;
+        r.querySeqId = e.querySeqId;
+        r.refSeqId = e.refSeqId;
+        r.conservedSketches = e.conservedSketches;
+        r.nucIdentity = e.nucIdentity;
+        r.jaccard = float(e.conservedSketches) / e.sketchSize;
+        r.strand = e.strand;
+        return r;
+      }
+
+      /**
+       * @brief     append the records of mappings to an output buffer
+       */
+      static void append(std::string& out, const MappingResultsVector_t& mappings)
+      {
+        for (const auto& e : mappings)
+        {
+          BinaryMappingRecord r = encode(e);
+          out.append(reinterpret_cast<const char*>(&r), sizeof(r));
+        }
+      }
+
+      /**
+       * @brief     open a binary mapping file and read its header
+       */
+      void open(const std::string& filename)
+      {
+        in.open(filename, std::ios::binary);
+        std::string head;
+        if (!readMagic(in, head))
+        {
+          std::cerr << "[wfmash] Error: " << filename << " is not a binary mapping file of version " << VERSION << std::endl;
+          exit(1);
+        }
+        readHeader(filename);
+      }
+
+      /**
+       * @brief     read the rest of the header from a stream whose magic number was
+       *            read by readMagic, e.g. a pipe that cannot be reopened
+       */
+      void open(std::ifstream&& stream, const std::string& filename)
+      {
+        in = std::move(stream);
+        readHeader(filename);
+      }
+
+      /**
+       * @brief     read the next record
+       * @return    false at the end of the file
+       */
+      bool next(BinaryMappingRecord& r)
+      {
+        if (bufferPos == buffer.size())
+        {
+          buffer.resize(buffer.capacity());
+          in.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(BinaryMappingRecord));
+          size_t bytes = in.gcount();
+          if (bytes % sizeof(BinaryMappingRecord) != 0)
+          {
+            std::cerr << "[wfmash] Error: binary mapping file is truncated or corrupt" << std::endl;
+            exit(1);
+          }
+          buffer.resize(bytes / sizeof(BinaryMappingRecord));
+          bufferPos = 0;
+          if (buffer.empty())
+            return false;
+        }
+        r = buffer[bufferPos++];
+        if (size_t(r.querySeqId) >= names.size() || size_t(r.refSeqId) >= names.size())
+        {
+          std::cerr << "[wfmash] Error: binary mapping file is truncated or corrupt" << std::endl;
+          exit(1);
+        }
+        return true;
+      }
+
+      /**
+       * @brief     write a record as the PAF line the mapper would have written
+       */
+      void writePaf(wflign::RecordWriter& out, const BinaryMappingRecord& r) const
+      {
+        float fakeMapQ = r.nucIdentity == 1 ? 255 : std::round(-10.0 * std::log10(1-(r.nucIdentity)));
+
+        out << names[r.querySeqId]
+            << '\t' << lengths[r.querySeqId]
+            << '\t' << r.queryStartPos
+            << '\t' << r.queryEndPos
+            << '\t' << (r.strand == strnd::FWD ? "+" : "-")
+            << '\t' << names[r.refSeqId]
+            << '\t' << lengths[r.refSeqId]
+            << '\t' << r.refStartPos
+            << '\t' << r.refEndPos
+            << '\t' << r.conservedSketches
+            << '\t' << r.blockLength
+            << '\t' << fakeMapQ
+            << '\t' << "id:f:" << r.nucIdentity
+            << '\t' << "kc:f:" << r.kmerComplexity;
+        if (flags & FLAG_CHAIN_TAGS)
+          out << '\t' << "chain:i:" << r.splitMappingId;
+        else
+          out << '\t' << "jc:f:" << r.jaccard;
+        out << '\n';
+      }
+
+      /**
+       * @brief     convert a binary mapping file to PAF
+       */
+      static void toPaf(const std::string& inFile, std::ostream& out)
+      {
+        BinaryMappings reader;
+        reader.open(inFile);
+
+        std::string buf;
+        wflign::RecordWriter record(buf);
+        BinaryMappingRecord r;
+        while (reader.next(r))
+        {
+          reader.writePaf(record, r);
+          if (buf.size() >= (1 << 20))
+          {
+            out.write(buf.data(), buf.size());
+            buf.clear();
+          }
+        }
+        out.write(buf.data(), buf.size());
+      }
+
+      /**
+       * @brief     convert a PAF file of approximate mappings to the binary format
+       * @details   A regular file is read twice: once for the sequence table of
+       *            the header, then for the records, which are written as they
+       *            are parsed. Other input, such as a pipe, is read once, with the
+       *            records spilled to a temporary file until the table is
+       *            complete. Missing tags are stored as zero, and a missing or
+       *            malformed identity as the default mapping identity.
+       */
+      static void fromPaf(const std::string& inFile, std::ostream& out)
+      {
+        std::vector<std::string> names;
+        std::vector<offset_t> lengths;
+        std::unordered_map<std::string, seqno_t> ids;
+        uint32_t flags = 0;
+
+        auto idOf = [&](const std::string& name, offset_t length) {
+          auto it = ids.find(name);
+          if (it != ids.end())
+            return it->second;
+          seqno_t id = names.size();
+          ids.emplace(name, id);
+          names.push_back(name);
+          lengths.push_back(length);
+          return id;
+        };
+
+        //Parses a line into r, adding its sequences to the table; false for empty lines
+        auto parse = [&](const std::string& line, BinaryMappingRecord& r) {
+          if (line.empty())
+            return false;
+          std::vector<std::string> t = CommonFunc::split(line, '\t');
+          if (t.size() < 12)
+          {
+            std::cerr << "[wfmash] Error: invalid PAF record: " << line << std::endl;
+            exit(1);
+          }
+
+          std::memset(&r, 0, sizeof(r));
+          r.querySeqId = idOf(t[0], std::stoll(t[1]));
+          r.queryStartPos = std::stoll(t[2]);
+          r.queryEndPos = std::stoll(t[3]);
+          r.strand = t[4] == "+" ? strnd::FWD : strnd::REV;
+          r.refSeqId = idOf(t[5], std::stoll(t[6]));
+          r.refStartPos = std::stoll(t[7]);
+          r.refEndPos = std::stoll(t[8]);
+          r.conservedSketches = std::stol(t[9]);
+          r.blockLength = std::stoll(t[10]);
+          r.nucIdentity = fixed::percentage_identity;
+          for (size_t i = 12; i < t.size(); i++)
+          {
+            if (t[i].compare(0, 8, "chain:i:") == 0)
+              flags |= FLAG_CHAIN_TAGS;
+            const char* value = t[i].c_str() + t[i].rfind(':') + 1;
+            char* end = nullptr;
+            double number = std::strtod(value, &end);
+            if (end == value || *end != '\0')
+              continue;
+            if (t[i].compare(0, 5, "id:f:") == 0)
+              r.nucIdentity = number;
+            else if (t[i].compare(0, 5, "kc:f:") == 0)
+              r.kmerComplexity = number;
+            else if (t[i].compare(0, 5, "jc:f:") == 0)
+              r.jaccard = number;
+            else if (t[i].compare(0, 8, "chain:i:") == 0)
+              r.splitMappingId = std::stoll(t[i].substr(8));
+          }
+          return true;
+        };
+
+        std::ifstream paf(inFile);
+        if (!paf)
+        {
+          std::cerr << "[wfmash] Error: unable to open mapping file " << inFile << std::endl;
+          exit(1);
+        }
+        std::string line;
+        BinaryMappingRecord r;
+        std::string buf;
+        auto flush = [&](std::ostream& to, size_t atLeast) {
+          if (buf.size() >= atLeast)
+          {
+            to.write(buf.data(), buf.size());
+            buf.clear();
+          }
+        };
+
+        std::error_code ec;
+        if (std::filesystem::is_regular_file(inFile, ec))
+        {
+          while (std::getline(paf, line))
+            parse(line, r);
+          writeHeader(out, flags, names, lengths);
+
+          paf.clear();
+          paf.seekg(0);
+          while (std::getline(paf, line))
+          {
+            if (!parse(line, r))
+              continue;
+            buf.append(reinterpret_cast<const char*>(&r), sizeof(r));
+            flush(out, 1 << 20);
+          }
+          flush(out, 0);
+          return;
+        }
+
+        std::string spillFile = yeet::temp_file::create("wfmash-paf-to-binary-", ".bin");
+        std::ofstream spill(spillFile, std::ios::binary);
+        while (std::getline(paf, line))
+        {
+          if (!parse(line, r))
+            continue;
+          buf.append(reinterpret_cast<const char*>(&r), sizeof(r));
+          flush(spill, 1 << 20);
+        }
+        flush(spill, 0);
+        spill.close();
+        if (!spill)
+        {
+          std::cerr << "[wfmash] Error: failed to write temporary file " << spillFile << std::endl;
+          exit(1);
+        }
+
+        writeHeader(out, flags, names, lengths);
+        std::ifstream records(spillFile, std::ios::binary);
+        buf.resize(1 << 20);
+        while (records.read(&buf[0], buf.size()) || records.gcount() > 0)
+          out.write(buf.data(), records.gcount());
+        yeet::temp_file::remove(spillFile);
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,139 @@
+/**
+ * @file    blockingQueue.hpp
+ * @brief   bounded multi-producer multi-consumer queue used between the
+ *          stages of the mapping pipeline
+ */
+
+#ifndef SKETCH_BLOCKING_QUEUE_HPP
+#define SKETCH_BLOCKING_QUEUE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace skch
+{
+  /**
+   * @brief   counters describing how a pipeline stage behaved
+   */
+  struct QueueStats
+  {
+    uint64_t pushed = 0;              //items that went through the queue
+    uint64_t maxDepth = 0;            //largest number of items queued at once
+    uint64_t producerWaitNs = 0;      //time producers spent blocked on a full queue
+    uint64_t consumerWaitNs = 0;      //time consumers spent blocked on an empty queue
+  };
+
+  /**
+   * @class     skch::BlockingQueue
+   * @brief     bounded FIFO queue; producers block while it is full and
+   *            consumers block while it is empty, instead of polling
+   * @details   close() wakes every waiter: pending items are still handed out,
+   *            after which pop() returns false
+   */
+  template <typename T>
+  class BlockingQueue
+  {
+    private:
+
+      std::deque<T> items;
+      size_t capacity;
+      bool closed = false;
+
+      mutable std::mutex mutex;
+      std::condition_variable notEmpty;
+      std::condition_variable notFull;
+
+      QueueStats counters;
+
+      static uint64_t elapsedNs(std::chrono::steady_clock::time_point since)
+      {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - since).count();
+      }
+
+    public:
+
+      explicit BlockingQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+      BlockingQueue(const BlockingQueue&) = delete;
+      BlockingQueue& operator=(const BlockingQueue&) = delete;
+
+      /**
+       * @brief     add an item, waiting for free space if needed
+       * @return    false if the queue was closed and the item was not added
+       */
+      bool push(T item)
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (items.size() >= capacity && !closed)
+        {
+          auto start = std::chrono::steady_clock::now();
+          notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+          counters.producerWaitNs += elapsedNs(start);
+        }
+        if (closed)
+          return false;
+
+        items.push_back(std::move(item));
+        counters.pushed++;
+        counters.maxDepth = std::max<uint64_t>(counters.maxDepth, items.size());
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
+      }
+
+      /**
+       * @brief     remove the oldest item, waiting for one to arrive if needed
+       * @return    false once the queue is closed and drained
+       */
+      bool pop(T& item)
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (items.empty() && !closed)
+        {
+          auto start = std::chrono::steady_clock::now();
+          notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+          counters.consumerWaitNs += elapsedNs(start);
+        }
+        if (items.empty())
+          return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+      }
+
+      /**
+       * @brief     signal that no more items will be pushed
+       */
+      void close()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          closed = true;
+        }
+        notEmpty.notify_all();
+        notFull.notify_all();
+      }
+
+      size_t size() const
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
+      }
+
+      QueueStats stats() const
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * @file    bottomSketch.hpp
+ * @brief   reusable container keeping the s smallest distinct hashes of a
+ *          sequence, used to sketch query fragments
+ */
+
+#ifndef SKETCH_BOTTOM_SKETCH_HPP
+#define SKETCH_BOTTOM_SKETCH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+
+namespace skch
+{
+  /**
+   * @class     skch::BottomSketch
+   * @brief     bounded bottom-s set of minmers
+   * @details   A max-heap of the retained hashes sits next to an open-addressed
+   *            table (linear probing, backward-shift deletion) from hash to
+   *            MinmerInfo. The table has a fixed power of two capacity of at
+   *            least twice the sketch size, so it never grows while a sequence
+   *            is sketched. Slots are occupied if stamped with the current epoch,
+   *            so reset() is O(1) and memory is reused across sequences; the
+   *            caller keeps one instance per thread.
+   */
+  class BottomSketch
+  {
+    private:
+
+      std::vector<MinmerInfo> slots;
+      std::vector<uint32_t> stamp;             //slot is occupied if stamp == epoch
+      std::vector<hash_t> heap;                 //max-heap of retained hashes
+      size_t mask = 0;
+      size_t sketchSize = 0;
+      uint32_t epoch = 0;
+
+      inline bool used(size_t i) const
+      {
+        return stamp[i] == epoch;
+      }
+
+      inline size_t home(hash_t hash) const
+      {
+        //Hashes are already well mixed, fold the high bits in anyway
+        return (hash ^ (hash >> 32)) & mask;
+      }
+
+      inline size_t find(hash_t hash) const
+      {
+        size_t i = home(hash);
+        while (used(i) && slots[i].hash != hash)
+          i = (i + 1) & mask;
+        return i;
+      }
+
+      void erase(hash_t hash)
+      {
+        size_t i = find(hash);
+        stamp[i] = 0;
+        //Shift back entries whose probe sequence ran through the freed slot
+        for (size_t j = (i + 1) & mask; used(j); j = (j + 1) & mask)
+        {
+          size_t h = home(slots[j].hash);
+          if (((j - h) & mask) >= ((j - i) & mask))
+          {
+            slots[i] = slots[j];
+            stamp[i] = epoch;
+            stamp[j] = 0;
+            i = j;
+          }
+        }
+      }
+
+      //Replace the heap maximum with a smaller hash and sift it down
+      void replaceTop(hash_t hash)
+      {
+        size_t n = heap.size();
+        size_t i = 0;
+        while (true)
+        {
+          size_t c = 2 * i + 1;
+          if (c >= n)
+            break;
+          if (c + 1 < n && heap[c + 1] > heap[c])
+            c++;
+          if (heap[c] <= hash)
+            break;
+          heap[i] = heap[c];
+          i = c;
+        }
+        heap[i] = hash;
+      }
+
+    public:
+
+      /**
+       * @brief     empty the container and size it for a sketch of s hashes
+       */
+      void reset(size_t s)
+      {
+        sketchSize = s;
+        size_t capacity = 16;
+        while (capacity < 2 * (s + 1))
+          capacity <<= 1;
+        if (capacity > slots.size())
+        {
+          slots.resize(capacity);
+          stamp.assign(capacity, 0);
+          epoch = 0;
+        }
+        if (++epoch == 0)
+        {
+          std::fill(stamp.begin(), stamp.end(), 0);
+          epoch = 1;
+        }
+        mask = slots.size() - 1;
+        heap.clear();
+        heap.reserve(s + 1);
+      }
+
+      /**
+       * @brief     offer the minmer at position pos
+       * @details   Matches the std::map based selection it replaces: a hash already
+       *            retained extends its window and votes for its strand, a new hash
+       *            is kept if it is among the s smallest seen so far.
+       */
+      inline void add(hash_t hash, offset_t pos, seqno_t seqId, strand_t strand)
+      {
+        if (heap.size() >= sketchSize && (heap.empty() || hash > heap.front()))
+          return;
+
+        size_t i = find(hash);
+        if (used(i))
+        {
+          slots[i].wpos_end = pos;
+          slots[i].strand += strand == strnd::FWD ? 1 : -1;
+          return;
+        }
+        slots[i] = MinmerInfo{hash, pos, pos, seqId, strand};
+        stamp[i] = epoch;
+
+        if (heap.size() < sketchSize)
+        {
+          heap.push_back(hash);
+          std::push_heap(heap.begin(), heap.end());
+          return;
+        }
+
+        //Full: the new hash replaces the largest one
+        erase(heap.front());
+        replaceTop(hash);
+      }
+
+      /**
+       * @brief     write the retained minmers in increasing hash order, with the
+       *            strand votes resolved to FWD, REV or AMBIG; empties the heap
+       */
+      template <typename T>
+        void extract(std::vector<T>& minmerIndex)
+        {
+          minmerIndex.resize(heap.size());
+          std::sort_heap(heap.begin(), heap.end());
+          for (size_t k = 0; k < heap.size(); k++)
+          {
+            MinmerInfo& mi = slots[find(heap[k])];
+            mi.strand = mi.strand > 0 ? strnd::FWD : (mi.strand == 0 ? strnd::AMBIG : strnd::REV);
+            minmerIndex[k] = mi;
+          }
+          heap.clear();
+        }
+  };
+}
+
+#endif
@@ -19,6 +19,7 @@
 
 //Own includes
 #include "map/include/map_parameters.hpp"
+#include "map/include/bottomSketch.hpp"
 
 //External includes
 #include "common/murmur3.h"
@@ -146,6 +147,56 @@ namespace skch {
             return hash;
         }
 
+        /**
+         * @brief   invertible 64-bit mix (murmur3 finalizer) of a 2-bit k-mer code
+         * @details being a bijection, distinct k-mers of up to 32 bases never collide;
+         *          the xor keeps poly-A away from the fixed point of the finalizer
+         */
+        inline hash_t mixKmerCode(uint64_t code) {
+            code ^= 0x9E3779B97F4A7C15ULL;
+            code ^= code >> 33;
+            code *= 0xff51afd7ed558ccdULL;
+            code ^= code >> 33;
+            code *= 0xc4ceb9fe1a85ec53ULL;
+            code ^= code >> 33;
+            return code;
+        }
+
+        /**
+         * @brief   rolling forward and reverse complement 2-bit codes of a DNA k-mer
+         * @details Bases are encoded as (base >> 1) & 3, i.e. A=0, C=1, T=2, G=3, so the
+         *          complement of a code is code ^ 2. Expects upper case ACGTN input and
+         *          kmerSize <= 32; k-mers spanning an N are garbage and must be skipped
+         *          by the caller, as with the Murmur path.
+         */
+        class RollingKmerHash {
+            uint64_t fwd = 0;
+            uint64_t rev = 0;
+            uint64_t mask;
+            int shift;
+
+          public:
+            explicit RollingKmerHash(int kmerSize)
+                : mask(kmerSize >= 32 ? ~0ULL : (1ULL << (2 * kmerSize)) - 1),
+                  shift(2 * (kmerSize - 1)) {}
+
+            inline void push(char base) {
+                uint64_t c = (base >> 1) & 3;
+                fwd = ((fwd << 2) | c) & mask;
+                rev = (rev >> 2) | ((c ^ 2) << shift);
+            }
+
+            inline hash_t forward() const { return mixKmerCode(fwd); }
+            inline hash_t reverse() const { return mixKmerCode(rev); }
+        };
+
+        /**
+         * @brief   true if the rolling hash applies; otherwise k-mers are hashed with Murmur
+         */
+        inline bool useRollingHash(KmerHash kmerHash, int kmerSize, int alphabetSize) {
+            return kmerHash == KmerHash::ROLLING_2BIT && alphabetSize == 4 && kmerSize <= 32;
+        }
+
         /**
          * @brief		takes hash value of kmer and adjusts it based on kmer's weight
          *					this value will determine its order for minimizer selection
@@ -186,22 +237,33 @@ namespace skch {
               offset_t len,
               int kmerSize, 
               int alphabetSize,
+              KmerHash kmerHash,
               int sketchSize,
               seqno_t seqCounter)
         {
           makeUpperCaseAndValidDNA(seq, len);
 
-          //Compute reverse complement of seq
-          std::unique_ptr<char[]> seqRev(new char[len]);
-          //char* seqRev = new char[len];
+          const bool rolling = useRollingHash(kmerHash, kmerSize, alphabetSize);
+          RollingKmerHash rollingHash(kmerSize);
 
-          if(alphabetSize == 4) //not protein
-            CommonFunc::reverseComplement(seq, seqRev.get(), len);
+          //Compute reverse complement of seq, only needed to hash with Murmur
+          static thread_local std::vector<char> seqRev;
 
-          // TODO cleanup
-          ankerl::unordered_dense::map<hash_t, MinmerInfo> sketched_vals;
-          std::vector<hash_t> sketched_heap;
-          sketched_heap.reserve(sketchSize+1);
+          if(rolling)
+          {
+            for (offset_t i = 0; i < kmerSize - 1 && i < len; i++)
+              rollingHash.push(seq[i]);
+          }
+          else if(alphabetSize == 4) //not protein
+          {
+            seqRev.resize(len);
+            CommonFunc::reverseComplement(seq, seqRev.data(), len);
+          }
+
+          // Reused by every sequence sketched on this thread
+          static thread_local BottomSketch threadSketch;
+          BottomSketch& sketched = threadSketch;
+          sketched.reset(sketchSize);
             
           // Get distance until last "N"
           int ambig_kmer_count = 0;
@@ -222,13 +284,23 @@ namespace skch {
               ambig_kmer_count = kmerSize;
             }
             //Hash kmers
-            hash_t hashFwd = CommonFunc::getHash(seq + i, kmerSize); 
+            hash_t hashFwd;
             hash_t hashBwd;
 
-            if(alphabetSize == 4)
-              hashBwd = CommonFunc::getHash(seqRev.get() + len - i - kmerSize, kmerSize);
-            else  //proteins
-              hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
+            if(rolling)
+            {
+              rollingHash.push(seq[i+kmerSize-1]);
+              hashFwd = rollingHash.forward();
+              hashBwd = rollingHash.reverse();
+            }
+            else
+            {
+              hashFwd = CommonFunc::getHash(seq + i, kmerSize); 
+              if(alphabetSize == 4)
+                hashBwd = CommonFunc::getHash(seqRev.data() + len - i - kmerSize, kmerSize);
+              else  //proteins
+                hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
+            }
 
             //Consider non-symmetric kmers only
             if(hashBwd != hashFwd && ambig_kmer_count == 0)
@@ -239,35 +311,7 @@ namespace skch {
               //Check the strand of this minimizer hash value
               auto currentStrand = hashFwd < hashBwd ? strnd::FWD : strnd::REV;
 
-              if (sketched_heap.size() < sketchSize || currentKmer <= sketched_heap.front())
-              {
-                if (sketched_heap.empty() || sketched_vals.find(currentKmer) == sketched_vals.end()) 
-                {
-
-                  // Add current hash to heap
-                  if (sketched_vals.size() < sketchSize || currentKmer < sketched_heap.front())  
-                  {
-                      sketched_vals[currentKmer] = MinmerInfo{currentKmer, i, i, seqCounter, currentStrand};
-                      sketched_heap.push_back(currentKmer);
-                      std::push_heap(sketched_heap.begin(), sketched_heap.end());
-                  }
-
-                  // Remove one if too large
-                  if (sketched_vals.size() > sketchSize) 
-                  {
-                      sketched_vals.erase(sketched_heap[0]);
-                      std::pop_heap(sketched_heap.begin(), sketched_heap.end());
-                      sketched_heap.pop_back();
-                  }
-                } 
-                else 
-                {
-                  // TODO these sketched values might never be useful, might save memory by deleting
-                  // extend the length of the window
-                  sketched_vals[currentKmer].wpos_end = i;
-                  sketched_vals[currentKmer].strand += currentStrand == strnd::FWD ? 1 : -1;
-                }
-              }
+              sketched.add(currentKmer, i, seqCounter, currentStrand);
             }
             if (ambig_kmer_count > 0)
             {
@@ -275,15 +319,7 @@ namespace skch {
             }
           }
 
-          minmerIndex.resize(sketched_heap.size());
-          for (auto rev_it = minmerIndex.rbegin(); rev_it != minmerIndex.rend(); rev_it++)
-          {
-            *rev_it = (std::move(sketched_vals[sketched_heap.front()]));
-            (*rev_it).strand = (*rev_it).strand > 0 ? strnd::FWD : ((*rev_it).strand == 0 ? strnd::AMBIG : strnd::REV);
-
-            std::pop_heap(sketched_heap.begin(), sketched_heap.end());
-            sketched_heap.pop_back();
-          }
+          sketched.extract(minmerIndex);
           return;
         }
         
@@ -304,6 +340,7 @@ namespace skch {
               int kmerSize, 
               int windowSize,
               int alphabetSize,
+              KmerHash kmerHash,
               int sketchSize,
               seqno_t seqCounter,
               progress_meter::ProgressMeter* progress)
@@ -325,15 +362,25 @@ namespace skch {
 
             makeUpperCaseAndValidDNA(seq, len);
 
-            //Compute reverse complement of seq
+            const bool rolling = useRollingHash(kmerHash, kmerSize, alphabetSize);
+            RollingKmerHash rollingHash(kmerSize);
+
+            //Reverse complement of the current kmer, only needed to hash with Murmur
             std::unique_ptr<char[]> seqRev(new char[kmerSize]);
 
-            //if(alphabetSize == 4) //not protein
-              //CommonFunc::reverseComplement(seq, seqRev.get(), len);
-            
             // Get distance until last "N"
             int ambig_kmer_count = 0;
 
+            if (rolling)
+            {
+              for (offset_t i = 0; i < kmerSize - 1 && i < len; i++)
+              {
+                rollingHash.push(seq[i]);
+                if (seq[i] == 'N')
+                  ambig_kmer_count = i+1;
+              }
+            }
+
 
             for(offset_t i = 0; i < len - kmerSize + 1; i++)
             {
@@ -356,16 +403,26 @@ namespace skch {
               }
 
               //Hash kmers
-              hash_t hashFwd = CommonFunc::getHash(seq + i, kmerSize); 
+              hash_t hashFwd;
               hash_t hashBwd;
 
-              if(alphabetSize == 4) 
+              if(rolling)
               {
-                CommonFunc::reverseComplement(seq + i, seqRev.get(), kmerSize);
-                hashBwd = CommonFunc::getHash(seqRev.get(), kmerSize);
+                rollingHash.push(seq[i+kmerSize-1]);
+                hashFwd = rollingHash.forward();
+                hashBwd = rollingHash.reverse();
+              }
+              else
+              {
+                hashFwd = CommonFunc::getHash(seq + i, kmerSize); 
+                if(alphabetSize == 4) 
+                {
+                  CommonFunc::reverseComplement(seq + i, seqRev.get(), kmerSize);
+                  hashBwd = CommonFunc::getHash(seqRev.get(), kmerSize);
+                }
+                else  //proteins
+                  hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
               }
-              else  //proteins
-                hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
 
               //Take minimum value of kmer and its reverse complement
               hash_t currentKmer = std::min(hashFwd, hashBwd);
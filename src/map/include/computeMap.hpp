@@ -27,21 +27,30 @@ namespace fs = std::filesystem;
 #include <condition_variable>
 #include <mutex>
 #include <sstream>
-#include "common/atomic_queue/atomic_queue.h"
 
 //Own includes
 #include "map/include/base_types.hpp"
 #include "map/include/map_parameters.hpp"
 #include "map/include/commonFunc.hpp"
 #include "map/include/winSketch.hpp"
+#include "map/include/indexDirectory.hpp"
+#include "map/include/hashCounter.hpp"
+#include "map/include/seedMerge.hpp"
 #include "map/include/map_stats.hpp"
 #include "map/include/slidingMap.hpp"
 #include "map/include/MIIteratorL2.hpp"
 #include "map/include/filter.hpp"
+#include "map/include/blockingQueue.hpp"
+#include "map/include/taskPool.hpp"
+#include "map/include/threadBudget.hpp"
+#include "map/include/querySketchCache.hpp"
+#include "map/include/mappingStore.hpp"
+#include "map/include/binaryMappings.hpp"
 
 //External includes
 #include "common/seqiter.hpp"
 #include "common/progress.hpp"
+#include "common/wflign/src/record_writer.hpp"
 #include "map_stats.hpp"
 #include "robin-hood-hashing/robin_hood.h"
 // if we ever want to do the union-find chaining in parallel
@@ -58,6 +67,8 @@ namespace skch
       std::vector<MappingResult> results;        // Non-merged mappings
       std::vector<MappingResult> mergedResults;  // Maximally merged mappings  
       std::mutex mutex;
+      std::atomic<int> fragmentsRemaining{0};
+      std::unique_ptr<QuerySketchCache::Query> sketches;  // Fragment sketches, recorded or replayed
       progress_meter::ProgressMeter& progress;
       QueryMappingOutput(const std::string& name, const std::vector<MappingResult>& r, 
                         const std::vector<MappingResult>& mr, progress_meter::ProgressMeter& p)
@@ -73,7 +84,14 @@ namespace skch
       int refGroup;
       int fragmentIndex;
       QueryMappingOutput* output;
-      std::atomic<int>* fragments_processed;
+      InputSeqProgContainer* input;
+      QuerySketchCache::Fragment* sketch;  // Where to record the sketch, or the sketch to replay
+      bool replay;
+  };
+
+  struct QueryInput {
+      InputSeqProgContainer* input;
+      std::unique_ptr<QuerySketchCache::Query> sketches;  // Set when replaying cached sketches
   };
 
   /**
@@ -137,6 +155,14 @@ namespace skch
       typedef std::function< void(const MappingResult&) > PostProcessResultsFn_t;
       PostProcessResultsFn_t processMappingResults;
 
+      //Custom function taking the final mappings of each query instead of the output file,
+      //called concurrently from the finalization tasks
+      typedef std::function< void(const MappingResultsVector_t&, const SequenceIdManager&) > QueryMappingsFn_t;
+      QueryMappingsFn_t processQueryMappings;
+
+      //Permits shared with the aligner, held by the finalization tasks while they compute
+      ThreadBudget* threadBudget;
+
       //Container to store query sequence name and length
       //used only if one-to-one filtering is ON
       std::vector<ContigInfo> qmetadata;
@@ -145,24 +171,42 @@ namespace skch
       //for an L1 candidate if the best intersection size is i;
       std::vector<int> sketchCutoffs; 
 
-      // Sequence ID manager
-      // Atomic queues for input and output
-      typedef atomic_queue::AtomicQueue<InputSeqProgContainer*, 1024, nullptr, true, true, false, false> input_atomic_queue_t;
-      typedef atomic_queue::AtomicQueue<QueryMappingOutput*, 1024, nullptr, true, true, false, false> merged_mappings_queue_t;
-      typedef atomic_queue::AtomicQueue<std::pair<seqno_t, MappingResultsVector_t*>*, 1024> aggregate_atomic_queue_t;
-      typedef atomic_queue::AtomicQueue<std::string*, 1024> writer_atomic_queue_t;
-      typedef atomic_queue::AtomicQueue<QueryMappingOutput*, 1024, nullptr, true, true, false, false> query_output_atomic_queue_t;
-      typedef atomic_queue::AtomicQueue<FragmentData*, 8192, nullptr, true, true, false, false> fragment_atomic_queue_t;
+      // Blocking queues connecting the pipeline stages
+      typedef BlockingQueue<QueryInput> input_queue_t;
+      typedef BlockingQueue<QueryMappingOutput*> merged_mappings_queue_t;
+      typedef BlockingQueue<std::pair<seqno_t, MappingResultsVector_t>> combined_queue_t;
+      typedef BlockingQueue<std::string*> writer_queue_t;
+
+      // Output strings passed from the finalization tasks to the writer and back
+      wflign::RecordBufferPool outputBuffers;
+
+      // Workers running query, fragment and finalization tasks
+      std::unique_ptr<TaskPool> taskPool;
+
+      // Query fragment sketches shared by all target subsets
+      std::unique_ptr<QuerySketchCache> querySketchCache;
+      bool recordQuerySketches = false;
       
       // Track maximum chain ID seen across all subsets
       std::atomic<offset_t> maxChainIdSeen{0};
 
+      // Time spent in L2 sweeps, summed over the worker threads
+      std::atomic<uint64_t> l2Nanoseconds{0};
+      std::atomic<uint64_t> l2Candidates{0};
+
+      // Seed lookups of query minmers, and how many passed the seed filter and were found
+      std::atomic<uint64_t> seedLookups{0};
+      std::atomic<uint64_t> seedFilterPasses{0};
+      std::atomic<uint64_t> seedHits{0};
+
+
+    void processFragment(FragmentData* fragment, merged_mappings_queue_t& merged_queue) {
+        // Scratch buffers are reused by all fragments mapped on this worker
+        static thread_local std::vector<IntervalPoint> intervalPoints;
+        static thread_local std::vector<L1_candidateLocus_t> l1Mappings;
+        static thread_local MappingResultsVector_t l2Mappings;
+        static thread_local QueryMetaData<MinVec_Type> Q;
 
-    void processFragment(FragmentData* fragment, 
-                         std::vector<IntervalPoint>& intervalPoints,
-                         std::vector<L1_candidateLocus_t>& l1Mappings,
-                         MappingResultsVector_t& l2Mappings,
-                         QueryMetaData<MinVec_Type>& Q) {
         intervalPoints.clear();
         l1Mappings.clear();
         l2Mappings.clear();
@@ -174,6 +218,31 @@ namespace skch
         Q.seqName = fragment->seqName;
         Q.refGroup = fragment->refGroup;
 
+        //1. Compute the minmers, or reuse the ones computed for a previous target subset
+        if (fragment->replay) {
+            const auto& sketch = *fragment->sketch;
+            Q.minmerTableQuery.resize(sketch.hashes.size());
+            for (size_t i = 0; i < sketch.hashes.size(); i++) {
+                Q.minmerTableQuery[i] = MinmerInfo{sketch.hashes[i], 0, 0, Q.seqId, sketch.strands[i]};
+            }
+            Q.sketchSize = Q.minmerTableQuery.size();
+            Q.kmerComplexity = sketch.kmerComplexity;
+        } else {
+            getSeedHits(Q);
+            if (fragment->sketch != nullptr) {
+                auto& sketch = *fragment->sketch;
+                sketch.fragmentIndex = fragment->fragmentIndex;
+                sketch.len = fragment->len;
+                sketch.kmerComplexity = Q.kmerComplexity;
+                sketch.hashes.resize(Q.sketchSize);
+                sketch.strands.resize(Q.sketchSize);
+                for (int i = 0; i < Q.sketchSize; i++) {
+                    sketch.hashes[i] = Q.minmerTableQuery[i].hash;
+                    sketch.strands[i] = Q.minmerTableQuery[i].strand;
+                }
+            }
+        }
+
         mapSingleQueryFrag(Q, intervalPoints, l1Mappings, l2Mappings);
 
         std::for_each(l2Mappings.begin(), l2Mappings.end(), [&](MappingResult &e){
@@ -194,7 +263,10 @@ namespace skch
         // Update progress after processing the fragment
         fragment->output->progress.increment(fragment->len);
 
-        fragment->fragments_processed->fetch_add(1, std::memory_order_relaxed);
+        // The last fragment of a query to finish completes the query
+        if (fragment->output->fragmentsRemaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            finalizeQuery(fragment->input, fragment->output, merged_queue);
+        }
         delete fragment;
     }
       
@@ -205,11 +277,18 @@ namespace skch
        * @param[in] p           algorithm parameters
        * @param[in] refSketch   reference sketch
        * @param[in] f           optional user defined custom function to post process the reported mapping results
+       * @param[in] g           optional function receiving the final mappings of each query, nothing is written if set
+       * @param[in] budget      optional permits shared with the consumer of g, which runs while
+       *                        the mappings are merged and filtered
        */
       Map(skch::Parameters p,
-          PostProcessResultsFn_t f = nullptr) :
+          PostProcessResultsFn_t f = nullptr,
+          QueryMappingsFn_t g = nullptr,
+          ThreadBudget* budget = nullptr) :
         param(p),
         processMappingResults(f),
+        processQueryMappings(g),
+        threadBudget(budget),
         sketchCutoffs(std::min<double>(p.sketchSize, skch::fixed::ss_table_max) + 1, 1),
         idManager(std::make_unique<SequenceIdManager>(
             p.querySequences,
@@ -385,10 +464,10 @@ namespace skch
       }
 
       /**
-       * @brief   parse over sequences in query file and map each on the reference
+       * @brief   parse over sequences in query file and schedule each for mapping on the reference
        */
-      void reader_thread(input_atomic_queue_t& input_queue,
-                         std::atomic<bool>& reader_done,
+      void reader_thread(input_queue_t& input_queue,
+                         merged_mappings_queue_t& merged_queue,
                          progress_meter::ProgressMeter& progress,
                          SequenceIdManager& idManager) {
           // Define allowed_query_names here
@@ -409,66 +488,36 @@ namespace skch
                   [&](const std::string& seq_name, const std::string& seq) {
                       seqno_t seqId = idManager.getSequenceId(seq_name);
                       auto input = new InputSeqProgContainer(seq, seq_name, seqId, progress);
-                      while (!input_queue.try_push(input)) {
-                          std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                      }
+                      scheduleQuery(QueryInput{input, nullptr}, input_queue, merged_queue);
                   });
           }
-          reader_done.store(true);
       }
 
-      void worker_thread(input_atomic_queue_t& input_queue,
-                         fragment_atomic_queue_t& fragment_queue,
+      /**
+       * @brief   schedule the queries recorded in the query sketch cache for mapping on the reference
+       */
+      void replay_thread(input_queue_t& input_queue,
                          merged_mappings_queue_t& merged_queue,
-                         progress_meter::ProgressMeter& progress,
-                         std::atomic<bool>& reader_done,
-                         std::atomic<bool>& workers_done) {
-          while (true) {
-              InputSeqProgContainer* input = nullptr;
-              if (input_queue.try_pop(input)) {
-                  auto output = mapModule(input, fragment_queue);
-                  //progress.increment(input->len / 4);
-                  while (!merged_queue.try_push(output)) {
-                      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                  }
-                  delete input;
-              } else if (reader_done.load() && input_queue.was_empty()) {
-                  break;
-              } else {
-                  std::this_thread::sleep_for(std::chrono::milliseconds(10));
-              }
-          }
+                         progress_meter::ProgressMeter& progress) {
+          querySketchCache->forEach([&](QuerySketchCache::Query&& cached) {
+              auto input = new InputSeqProgContainer("", cached.name, cached.seqId, progress);
+              input->len = cached.len;
+              scheduleQuery(QueryInput{input, std::make_unique<QuerySketchCache::Query>(std::move(cached))},
+                            input_queue, merged_queue);
+          });
       }
 
-      void writer_thread(query_output_atomic_queue_t& output_queue,
-                         std::atomic<bool>& workers_done,
-                         seqno_t& totalReadsMapped,
-                         std::ofstream& outstrm,
-                         progress_meter::ProgressMeter& progress,
-                         MappingResultsVector_t& allReadMappings) {
-          int wait_count = 0;
-          while (true) {
-              QueryMappingOutput* output = nullptr;
-              if (output_queue.try_pop(output)) {
-                  wait_count = 0;
-                  if(output->results.size() > 0)
-                      totalReadsMapped++;
-                  if (param.filterMode == filter::ONETOONE) {
-                      allReadMappings.insert(allReadMappings.end(), output->results.begin(), output->results.end());
-                  } else {
-                      reportReadMappings(output->results, output->queryName, outstrm);
-                  }
-                  delete output;
-              } else {
-                  if (workers_done.load() && output_queue.was_empty()) {
-                      ++wait_count;
-                  }
-                  if (wait_count > 10) {
-                      break;
-                  }
-                  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      void scheduleQuery(QueryInput&& query,
+                         input_queue_t& input_queue,
+                         merged_mappings_queue_t& merged_queue) {
+          // Blocks while too many queries are waiting to be mapped
+          input_queue.push(std::move(query));
+          taskPool->submit([this, &input_queue, &merged_queue]() {
+              QueryInput next;
+              if (input_queue.pop(next)) {
+                  mapModule(next.input, std::move(next.sketches), merged_queue);
               }
-          }
+          });
       }
 
       std::vector<std::vector<std::string>> createTargetSubsets(const std::vector<std::string>& targetSequenceNames) {
@@ -505,7 +554,13 @@ namespace skch
         seqno_t totalReadsPickedForMapping = 0;
         seqno_t totalReadsMapped = 0;
 
-        std::ofstream outstrm(param.outFileName);
+        std::ofstream outstrm;
+        if (processQueryMappings == nullptr) {
+            outstrm.open(param.outFileName);
+            if (param.binaryMappings) {
+                writeBinaryMappingsHeader(outstrm);
+            }
+        }
 
         // Get sequence names from ID manager
 
@@ -526,12 +581,6 @@ namespace skch
         }
 
 
-        // Initialize atomic queues and flags
-        input_atomic_queue_t input_queue;
-        merged_mappings_queue_t merged_queue;
-        fragment_atomic_queue_t fragment_queue;
-        writer_atomic_queue_t writer_queue;
-
         this->querySequenceNames = idManager->getQuerySequenceNames();
         this->targetSequenceNames = idManager->getTargetSequenceNames();
 
@@ -559,18 +608,39 @@ namespace skch
         }
         std::cerr << ", average size: " << std::fixed << std::setprecision(0) << avg_subset_size << "bp" << std::endl;
 
-        typedef std::vector<MappingResult> MappingResultsVector_t;
-        std::unordered_map<seqno_t, MappingResultsVector_t> combinedMappings;
+        // Mappings of every subset, spilled to disk until all subsets are done.
+        // A single subset has all the mappings of each query, which stay in memory
+        MappingRunStore combinedMappings(target_subsets.size() > 1);
 
         // Build index for the current subset
         // Open the index file once
         std::ifstream indexStream;
+        // Sub-index locations, if the index file has a directory
+        IndexDirectory indexDirectory;
+        bool haveIndexDirectory = false;
         if (!param.indexFilename.empty() && !param.create_index_only) {
             indexStream.open(param.indexFilename.string(), std::ios::binary);
             if (!indexStream) {
                 std::cerr << "Error: Unable to open index file: " << param.indexFilename << std::endl;
                 exit(1);
             }
+            uint64_t directoryOffset = 0;
+            haveIndexDirectory = indexDirectory.read(param.indexFilename.string(), directoryOffset);
+            if (haveIndexDirectory) {
+                checkIndexDirectory(indexDirectory, target_subsets);
+            }
+        }
+
+        if (!param.create_index_only) {
+            taskPool = std::make_unique<TaskPool>(param.threads);
+
+            // Sketch the queries once and replay the sketches for every further subset
+            if (target_subsets.size() > 1) {
+                uint64_t estimatedBytes = (total_seq_length / param.segLength + total_seqs)
+                    * (sizeof(QuerySketchCache::Fragment) + param.sketchSize * (sizeof(hash_t) + sizeof(strand_t)));
+                querySketchCache = std::make_unique<QuerySketchCache>(
+                    estimatedBytes > skch::fixed::query_sketch_cache_max_ram);
+            }
         }
 
         // For each subset of target sequences
@@ -600,17 +670,18 @@ namespace skch
                 if (!param.indexFilename.empty()) {
                     // Load index from file
                     std::cerr << "[wfmash::mashmap] Loading index for subset " << subset_count << " with " << target_subset.size() << " sequences" << std::endl;
+                    if (haveIndexDirectory) {
+                        // Checked to be present by checkIndexDirectory
+                        indexStream.seekg(indexDirectory.find(target_subset)->offset);
+                    }
                     refSketch = new skch::Sketch(param, *idManager, target_subset, &indexStream);
+                    adoptIndexKmerHash(subset_count);
                 } else {
                     std::cerr << "[wfmash::mashmap] Building index for subset " << subset_count << " with " << target_subset.size() 
                              << " sequences (" << subset_length << " bp)" << std::endl;
                     refSketch = new skch::Sketch(param, *idManager, target_subset);
                 }
-                std::atomic<bool> reader_done(false);
-                std::atomic<bool> workers_done(false);
-                std::atomic<bool> fragments_done(false);
-                processSubset(subset_count, target_subsets.size(), total_seq_length, input_queue, merged_queue, 
-                              fragment_queue, reader_done, workers_done, fragments_done, combinedMappings);
+                processSubset(subset_count, target_subsets.size(), total_seq_length, combinedMappings);
             }
 
             // Clean up the current refSketch
@@ -629,143 +700,196 @@ namespace skch
         }
 
         // Process combined mappings
-        std::atomic<bool> processing_done(false);
-        std::atomic<bool> workers_done(false);
-        std::atomic<bool> output_done(false);
-        aggregate_atomic_queue_t aggregate_queue;
+        writer_queue_t writer_queue(1024);
+
+        // Queries loaded from the store and waiting to be finalized
+        combined_queue_t combined_queue(2 * param.threads);
 
         // Get total count of mappings
-        uint64_t totalMappings = 0;
-        for (const auto& [querySeqId, mappings] : combinedMappings) {
-            totalMappings += mappings.size();
-        }
+        uint64_t totalMappings = combinedMappings.size();
 
         // Initialize progress logger
         progress_meter::ProgressMeter progress(
             totalMappings * 2,
             "[wfmash::mashmap] merging and filtering");
 
-        // Start worker threads
-        std::vector<std::thread> workers;
-        for (int i = 0; i < param.threads; ++i) {
-            workers.emplace_back(&Map::processCombinedMappingsThread, this, std::ref(aggregate_queue), std::ref(writer_queue), std::ref(processing_done), std::ref(progress));
-        }
+        auto poolBefore = taskPool->stats();
 
         // Start output thread
-        std::thread output_thread(&Map::outputThread, this, std::ref(outstrm), std::ref(writer_queue), std::ref(processing_done), std::ref(workers_done), std::ref(output_done));
-
-        // Enqueue tasks
-        for (auto& [querySeqId, mappings] : combinedMappings) {
-            auto* task = new std::pair<seqno_t, MappingResultsVector_t*>(querySeqId, &mappings);
-            while (!aggregate_queue.try_push(task)) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            }
-        }
+        std::thread output_thread(&Map::outputThread, this, std::ref(outstrm), std::ref(writer_queue));
+
+        // Merge the runs of all subsets one query at a time, with one finalization task per query
+        combinedMappings.forEachQuery([&](seqno_t querySeqId, MappingResultsVector_t&& mappings) {
+            // Blocks while too many loaded queries are waiting to be finalized
+            combined_queue.push(std::make_pair(querySeqId, std::move(mappings)));
+            taskPool->submit([this, &combined_queue, &writer_queue, &progress]() {
+                std::pair<seqno_t, MappingResultsVector_t> next;
+                if (combined_queue.pop(next)) {
+                    processCombinedMappings(next.first, next.second, writer_queue, progress);
+                }
+            });
+        });
 
-        // Signal that all tasks have been enqueued
-        processing_done.store(true);
+        // Wait for every query to be finalized, then let the writer drain
+        taskPool->wait();
+        writer_queue.close();
+        output_thread.join();
 
-        // Wait for worker threads to finish
-        for (auto& worker : workers) {
-            worker.join();
-        }
+        progress.finish();
 
-        workers_done.store(true);
+        logPipelineStats("merging and filtering", taskPool->stats(), poolBefore,
+                         {{"store", combined_queue.stats()}, {"writer", writer_queue.stats()}});
+      }
 
-        // Wait for output thread to finish
-        while (!output_done.load()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      /**
+       * @brief                 report per-stage counters of the mapping pipeline
+       * @param[in] stage       name of the pipeline run
+       * @param[in] pool        task pool counters after the run
+       * @param[in] poolBefore  task pool counters before the run
+       * @param[in] queues      named queues feeding or draining the task pool
+       */
+      void logPipelineStats(const std::string& stage,
+                            const TaskPool::Stats& pool,
+                            const TaskPool::Stats& poolBefore,
+                            const std::vector<std::pair<std::string, QueueStats>>& queues)
+      {
+        if (!param.verbose) {
+          return;
         }
-        output_thread.join();
+        auto seconds = [](uint64_t ns) {
+          std::ostringstream oss;
+          oss << std::fixed << std::setprecision(2) << ns / 1e9 << "s";
+          return oss.str();
+        };
+        std::ostringstream msg;
+        msg << "[wfmash::mashmap] " << stage << " pipeline: "
+            << pool.executed - poolBefore.executed << " tasks ("
+            << pool.stolen - poolBefore.stolen << " stolen), workers idle "
+            << seconds(pool.idleNs - poolBefore.idleNs);
+        for (const auto& q : queues) {
+          msg << "; " << q.first << " queue: " << q.second.pushed << " items, max depth "
+              << q.second.maxDepth << ", producers blocked " << seconds(q.second.producerWaitNs)
+              << ", consumers idle " << seconds(q.second.consumerWaitNs);
+        }
+        std::cerr << msg.str() << std::endl;
+      }
 
-        // Process both merged and non-merged mappings
-        for (auto& [querySeqId, mappings] : combinedMappings) {
-            if (param.mergeMappings && param.split) {
-                filterMaximallyMerged(mappings, param, progress);
-            } else {
-                filterNonMergedMappings(mappings, param, progress);
+      /**
+       * @brief   check before loading anything that the index file has a
+       *          sub-index for every target subset, built with our parameters
+       * @details sub-indexes are then loaded by seeking to them, so their order
+       *          in the file does not matter
+       */
+      void checkIndexDirectory(const IndexDirectory& directory,
+                               const std::vector<std::vector<std::string>>& target_subsets)
+      {
+        for (size_t i = 0; i < target_subsets.size(); ++i) {
+            if (target_subsets[i].empty()) {
+                continue;
+            }
+            const IndexDirectory::Entry* entry = directory.find(target_subsets[i]);
+            if (entry == nullptr) {
+                std::cerr << "[wfmash::mashmap] ERROR: index has no sub-index for target subset " << i
+                          << " (" << target_subsets[i].size() << " sequences starting with "
+                          << target_subsets[i].front() << "); rebuild it with the same target options" << std::endl;
+                exit(1);
+            }
+            if (entry->segLength != param.segLength
+                || entry->sketchSize != param.sketchSize
+                || entry->kmerSize != param.kmerSize) {
+                std::cerr << "[wfmash::mashmap] ERROR: Parameters of indexed sketch differ from current parameters" << std::endl;
+                std::cerr << "[wfmash::mashmap] Index --> segLength=" << entry->segLength
+                          << " sketchSize=" << entry->sketchSize << " kmerSize=" << entry->kmerSize << std::endl;
+                std::cerr << "[wfmash::mashmap] Current --> segLength=" << param.segLength
+                          << " sketchSize=" << param.sketchSize << " kmerSize=" << param.kmerSize << std::endl;
+                exit(1);
+            }
+            if (entry->kmerHash != directory.entries.front().kmerHash) {
+                std::cerr << "[wfmash::mashmap] ERROR: index subsets were sketched with different k-mer hashes" << std::endl;
+                exit(1);
             }
         }
+        std::cerr << "[wfmash::mashmap] Index directory lists " << directory.entries.size() << " sub-indexes" << std::endl;
+      }
 
-        progress.finish();
-
+      /**
+       * @brief   sketch queries with the k-mer hash of a loaded index
+       * @details query sketches of the first subset are replayed for the others,
+       *          so every subset of an index must use the same hash
+       */
+      void adoptIndexKmerHash(uint64_t subset_count)
+      {
+        KmerHash indexHash = refSketch->getKmerHash();
+        if (indexHash == param.kmerHash)
+          return;
+        if (subset_count != 0) {
+          std::cerr << "[wfmash::mashmap] ERROR: index subsets were sketched with different k-mer hashes" << std::endl;
+          exit(1);
+        }
+        std::cerr << "[wfmash::mashmap] Index uses "
+                  << (indexHash == KmerHash::MURMUR3 ? "Murmur" : "rolling 2-bit")
+                  << " k-mer hashes, sketching queries the same way" << std::endl;
+        param.kmerHash = indexHash;
       }
 
       void processSubset(uint64_t subset_count, size_t total_subsets, uint64_t total_seq_length,
-                         input_atomic_queue_t& input_queue, merged_mappings_queue_t& merged_queue,
-                         fragment_atomic_queue_t& fragment_queue, std::atomic<bool>& reader_done,
-                         std::atomic<bool>& workers_done, std::atomic<bool>& fragments_done,
-                         std::unordered_map<seqno_t, MappingResultsVector_t>& combinedMappings)
+                         MappingRunStore& combinedMappings)
       {
           progress_meter::ProgressMeter progress(
               total_seq_length,
               "[wfmash::mashmap] mapping ("
               + std::to_string(subset_count + 1) + "/" + std::to_string(total_subsets) + ")");
 
-          // Create temporary storage for this subset's mappings
-          std::unordered_map<seqno_t, MappingResultsVector_t> subsetMappings;
+          // Mappings of this subset go to a new run of the store
+          combinedMappings.beginRun();
 
-          // Launch reader thread
-          std::thread reader([&]() {
-              reader_thread(input_queue, reader_done, progress, *idManager);
-          });
-
-          std::vector<std::thread> fragment_workers;
-          for (int i = 0; i < param.threads; ++i) {
-              fragment_workers.emplace_back([&]() {
-                  fragment_thread(fragment_queue, fragments_done);
-              });
-          }
-
-          // Launch worker threads
-          std::vector<std::thread> workers;
-          for (int i = 0; i < param.threads; ++i) {
-              workers.emplace_back([&]() {
-                  worker_thread(input_queue, fragment_queue, merged_queue, progress, reader_done, workers_done);
-              });
-          }
+          input_queue_t input_queue(1024);
+          merged_mappings_queue_t merged_queue(1024);
+          auto poolBefore = taskPool->stats();
+          uint64_t l2NanosecondsBefore = l2Nanoseconds;
+          uint64_t l2CandidatesBefore = l2Candidates;
+          uint64_t seedLookupsBefore = seedLookups;
+          uint64_t seedFilterPassesBefore = seedFilterPasses;
+          uint64_t seedHitsBefore = seedHits;
 
           // Launch aggregator thread with subset storage
           std::thread aggregator([&]() {
-              aggregator_thread(merged_queue, workers_done, subsetMappings);
+              aggregator_thread(merged_queue, combinedMappings);
           });
 
-          // Wait for all threads to complete
-          reader.join();
-
-          for (auto& worker : workers) {
-              worker.join();
-          }
-          workers_done.store(true);
-          fragments_done.store(true);
-
-          for (auto& worker : fragment_workers) {
-              worker.join();
+          // Read queries and schedule their mapping on the task pool
+          if (querySketchCache && subset_count > 0) {
+              replay_thread(input_queue, merged_queue, progress);
+          } else {
+              recordQuerySketches = querySketchCache != nullptr;
+              reader_thread(input_queue, merged_queue, progress, *idManager);
           }
 
+          // Wait until every query has been mapped and handed to the aggregator
+          taskPool->wait();
+          merged_queue.close();
           aggregator.join();
-
-          // Filter mappings within this subset before merging with previous results
-          for (auto& [querySeqId, mappings] : subsetMappings) {
-              
-              // Merge with existing mappings for this query
-              if (combinedMappings.find(querySeqId) == combinedMappings.end()) {
-                  combinedMappings[querySeqId] = std::move(mappings);
-              } else {
-                  combinedMappings[querySeqId].insert(
-                      combinedMappings[querySeqId].end(),
-                      std::make_move_iterator(mappings.begin()),
-                      std::make_move_iterator(mappings.end())
-                  );
-              }
-          }
-
-          // Reset flags for next iteration
-          reader_done.store(false);
-          workers_done.store(false);
-          fragments_done.store(false);
+          recordQuerySketches = false;
+          combinedMappings.endRun();
 
           progress.finish();
+
+          logPipelineStats("mapping (" + std::to_string(subset_count + 1) + "/" + std::to_string(total_subsets) + ")",
+                           taskPool->stats(), poolBefore,
+                           {{"input", input_queue.stats()}, {"aggregator", merged_queue.stats()}});
+          if (param.verbose) {
+              std::cerr << "[wfmash::mashmap] L2 sweep: " << (l2Candidates - l2CandidatesBefore) << " candidates in "
+                        << std::fixed << std::setprecision(3) << (l2Nanoseconds - l2NanosecondsBefore) * 1e-9
+                        << "s of thread time" << std::endl;
+              std::cerr << "[wfmash::mashmap] Seed lookups: " << (seedLookups - seedLookupsBefore) << ", "
+                        << (seedFilterPasses - seedFilterPassesBefore) << " passed the seed filter, "
+                        << (seedHits - seedHitsBefore) << " found" << std::endl;
+          }
+          if (param.verbose && querySketchCache && subset_count == 0) {
+              std::cerr << "[wfmash::mashmap] Cached sketches of " << querySketchCache->size() << " queries ("
+                        << querySketchCache->bytes() << " bytes" << (querySketchCache->spilled() ? ", on disk" : "")
+                        << ") for the remaining target subsets" << std::endl;
+          }
       }
 
       /**
@@ -835,17 +959,73 @@ namespace skch
        */
       void sparsifyMappings(MappingResultsVector_t &readMappings)
       {
-          if (param.sparsity_hash_threshold < std::numeric_limits<uint64_t>::max()) {
+          if (param.sparsity_hash_threshold < std::numeric_limits<uint64_t>::max() && !sparsifyPairs()) {
               readMappings.erase(
                   std::remove_if(readMappings.begin(),
                                  readMappings.end(),
                                  [&](MappingResult &e){
-                                     return e.hash() > param.sparsity_hash_threshold;
+                                     return mixSparsityHash(e.hash()) > param.sparsity_hash_threshold;
                                  }),
                   readMappings.end());
           }
       }
 
+      /**
+       * @brief     run fn(first, last) in parallel over consecutive ranges of
+       *            independent groups, batched so that each task has a
+       *            reasonable amount of work
+       * @param[in] groupSizes  number of mappings in every group
+       */
+      void parallelForGroups(const std::vector<size_t>& groupSizes,
+                             const std::function<void(size_t, size_t)>& fn)
+      {
+        // Work under a permit of the thread budget stays on its thread
+        if (!taskPool || groupSizes.size() < 2 || ThreadBudget::held())
+        {
+          fn(0, groupSizes.size());
+          return;
+        }
+
+        size_t total = std::accumulate(groupSizes.begin(), groupSizes.end(), size_t(0));
+        size_t batchTarget = std::max<size_t>(1024, total / (4 * taskPool->size()));
+        std::vector<size_t> batchStarts{0};
+        size_t batchSize = 0;
+        for (size_t g = 0; g < groupSizes.size(); g++)
+        {
+          if (batchSize >= batchTarget)
+          {
+            batchStarts.push_back(g);
+            batchSize = 0;
+          }
+          batchSize += groupSizes[g];
+        }
+        batchStarts.push_back(groupSizes.size());
+
+        taskPool->parallelFor(batchStarts.size() - 1, [&](size_t b) {
+            fn(batchStarts[b], batchStarts[b+1]);
+        });
+      }
+
+      /**
+       * @brief                    helper to main filtering function
+       * @details                  applies the reference (one-to-one) filter to groups of
+       *                           mappings with independent plane sweeps, in parallel;
+       *                           same result as Filter::ref::filterMappings
+       * @param[in/out] mappings   mappings to filter, order is preserved
+       * @param[in]   n_mappings   num mappings per segment
+       * @return                   void
+       */
+      void filterByReference(
+          MappingResultsVector_t &mappings,
+          int n_mappings,
+          const SequenceIdManager& idManager)
+      {
+        skch::Filter::ref::filterMappingsByGroup(mappings, idManager, n_mappings, param.dropRand, param.overlap_threshold,
+            [this](const std::vector<size_t>& groupSizes, const std::function<void(size_t, size_t)>& fn) {
+                parallelForGroups(groupSizes, fn);
+            });
+      }
+
       /**
        * @brief                    helper to main filtering function
        * @details                  filters mappings by group
@@ -867,44 +1047,50 @@ namespace skch
 
         std::sort(unfilteredMappings.begin(), unfilteredMappings.end(), [](const auto& a, const auto& b) 
             { return std::tie(a.refSeqId, a.refStartPos) < std::tie(b.refSeqId, b.refStartPos); });
-        auto subrange_begin = unfilteredMappings.begin();
-        auto subrange_end = unfilteredMappings.begin();
         if (param.filterMode == filter::MAP || param.filterMode == filter::ONETOONE) 
         {
-          std::vector<skch::MappingResult> tmpMappings;
-          while (subrange_end != unfilteredMappings.end())
+          // Target groups are filtered independently of each other, in parallel
+          std::vector<size_t> groupStarts{0};
+          if (param.skip_prefix)
+          {
+            const auto& refGroups = idManager.getRefGroups();
+            for (size_t i = 1; i < unfilteredMappings.size(); i++)
+              if (refGroups[unfilteredMappings[i].refSeqId] != refGroups[unfilteredMappings[i-1].refSeqId])
+                groupStarts.push_back(i);
+          }
+          groupStarts.push_back(unfilteredMappings.size());
+
+          std::vector<size_t> groupSizes(groupStarts.size() - 1);
+          for (size_t g = 0; g < groupSizes.size(); g++)
+            groupSizes[g] = groupStarts[g+1] - groupStarts[g];
+          std::vector<MappingResultsVector_t> groupMappings(groupSizes.size());
+
+          parallelForGroups(groupSizes, [&](size_t first, size_t last) {
+              for (size_t g = first; g < last; g++)
+              {
+                auto& tmpMappings = groupMappings[g];
+                tmpMappings.assign(
+                    std::make_move_iterator(unfilteredMappings.begin() + groupStarts[g]),
+                    std::make_move_iterator(unfilteredMappings.begin() + groupStarts[g+1]));
+                std::sort(tmpMappings.begin(), tmpMappings.end(), [](const auto& a, const auto& b) 
+                    { return std::tie(a.queryStartPos, a.refSeqId, a.refStartPos) < std::tie(b.queryStartPos, b.refSeqId, b.refStartPos); });
+                if (filter_ref)
+                {
+                    filterByReference(tmpMappings, n_mappings, idManager);
+                }
+                else
+                {
+                    skch::Filter::query::filterMappings(tmpMappings, n_mappings, param.dropRand, param.overlap_threshold, progress);
+                }
+              }
+          });
+
+          for (auto& tmpMappings : groupMappings)
           {
-            if (param.skip_prefix)
-            {
-              int currGroup = idManager.getRefGroup(subrange_begin->refSeqId);
-              subrange_end = std::find_if_not(subrange_begin, unfilteredMappings.end(), [this, currGroup, &idManager] (const auto& candidate) {
-                  return currGroup == idManager.getRefGroup(candidate.refSeqId);
-              });
-            }
-            else
-            {
-              subrange_end = unfilteredMappings.end();
-            }
-            tmpMappings.insert(
-                tmpMappings.end(), 
-                std::make_move_iterator(subrange_begin), 
-                std::make_move_iterator(subrange_end));
-            std::sort(tmpMappings.begin(), tmpMappings.end(), [](const auto& a, const auto& b) 
-                { return std::tie(a.queryStartPos, a.refSeqId, a.refStartPos) < std::tie(b.queryStartPos, b.refSeqId, b.refStartPos); });
-            if (filter_ref)
-            {
-                skch::Filter::ref::filterMappings(tmpMappings, idManager, n_mappings, param.dropRand, param.overlap_threshold);
-            }
-            else
-            {
-                skch::Filter::query::filterMappings(tmpMappings, n_mappings, param.dropRand, param.overlap_threshold, progress);
-            }
             filteredMappings.insert(
                 filteredMappings.end(), 
                 std::make_move_iterator(tmpMappings.begin()), 
                 std::make_move_iterator(tmpMappings.end()));
-            tmpMappings.clear();
-            subrange_begin = subrange_end;
           }
         }
         //Sort the mappings by query (then reference) position
@@ -918,20 +1104,43 @@ namespace skch
 
 
       /**
-       * @brief               main mapping function given an input read
-       * @details             this function is run in parallel by multiple threads
-       * @param[in]   input   input read details
-       * @return              output object containing the mappings
+       * @brief                     main mapping function given an input read
+       * @details                   splits the read into fragments and schedules them on the
+       *                            task pool; the last fragment to finish finalizes the read
+       * @param[in]   input         input read details
+       * @param[in]   merged_queue  queue receiving the finalized mappings of the read
        */
-      QueryMappingOutput* mapModule(InputSeqProgContainer* input,
-                                    fragment_atomic_queue_t& fragment_queue) {
+      void mapModule(InputSeqProgContainer* input,
+                     std::unique_ptr<QuerySketchCache::Query> cachedSketches,
+                     merged_mappings_queue_t& merged_queue) {
 
         QueryMappingOutput* output = new QueryMappingOutput{input->name, {}, {}, input->progress};
-        std::atomic<int> fragments_processed{0};
-        bool split_mapping = true;
         int refGroup = this->idManager->getRefGroup(input->seqId);
 
         std::vector<FragmentData*> fragments;
+
+        if (cachedSketches) {
+            // Fragments were sketched while mapping against an earlier target subset
+            output->sketches = std::move(cachedSketches);
+            for (auto& sketch : output->sketches->fragments) {
+                fragments.push_back(new FragmentData{
+                    nullptr,
+                    sketch.len,
+                    static_cast<int>(input->len),
+                    input->seqId,
+                    input->name,
+                    refGroup,
+                    sketch.fragmentIndex,
+                    output,
+                    input,
+                    &sketch,
+                    true
+                });
+            }
+            scheduleFragments(input, output, fragments, merged_queue);
+            return;
+        }
+
         int noOverlapFragmentCount = input->len / param.segLength;
 
         for (int i = 0; i < noOverlapFragmentCount; i++) {
@@ -944,7 +1153,9 @@ namespace skch
                 refGroup,
                 i,
                 output,
-                &fragments_processed
+                input,
+                nullptr,
+                false
             };
             fragments.push_back(fragment);
         }
@@ -959,24 +1170,54 @@ namespace skch
                 refGroup,
                 noOverlapFragmentCount,
                 output,
-                &fragments_processed
+                input,
+                nullptr,
+                false
             };
             fragments.push_back(fragment);
             noOverlapFragmentCount++;
         }
 
-        for (auto& fragment : fragments) {
-            while (!fragment_queue.try_push(fragment)) {
-                //std::this_thread::yield(); // too fast
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        // Record the fragment sketches if they will be replayed for later target subsets
+        if (recordQuerySketches) {
+            output->sketches = std::make_unique<QuerySketchCache::Query>(
+                QuerySketchCache::Query{input->seqId, input->len, input->name,
+                                        std::vector<QuerySketchCache::Fragment>(fragments.size())});
+            for (size_t i = 0; i < fragments.size(); i++) {
+                fragments[i]->sketch = &output->sketches->fragments[i];
             }
         }
 
-        // Wait for all fragments to be processed
-        while (fragments_processed.load(std::memory_order_relaxed) < noOverlapFragmentCount) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        scheduleFragments(input, output, fragments, merged_queue);
+      }
+
+      void scheduleFragments(InputSeqProgContainer* input,
+                             QueryMappingOutput* output,
+                             const std::vector<FragmentData*>& fragments,
+                             merged_mappings_queue_t& merged_queue) {
+        if (fragments.empty()) {
+            finalizeQuery(input, output, merged_queue);
+            return;
         }
 
+        output->fragmentsRemaining.store(fragments.size(), std::memory_order_relaxed);
+        for (auto& fragment : fragments) {
+            taskPool->submit([this, fragment, &merged_queue]() {
+                processFragment(fragment, merged_queue);
+            });
+        }
+      }
+
+      /**
+       * @brief                     chain and filter the mappings of a read once all of its
+       *                            fragments have been mapped, and pass them on
+       * @param[in]   input         input read details, released here
+       * @param[in]   output        mappings of the read
+       * @param[in]   merged_queue  queue receiving the finalized mappings of the read
+       */
+      void finalizeQuery(InputSeqProgContainer* input,
+                         QueryMappingOutput* output,
+                         merged_mappings_queue_t& merged_queue) {
         mappingBoundarySanityCheck(input, output->results);
           
         // Filter and get both merged and non-merged mappings
@@ -984,26 +1225,14 @@ namespace skch
         output->results = std::move(nonMergedMappings);
         output->mergedResults = std::move(mergedMappings);
 
-        return output;
-      }
+        // Keep the fragment sketches for the following target subsets
+        if (output->sketches && recordQuerySketches) {
+            querySketchCache->add(*output->sketches);
+        }
+        output->sketches.reset();
 
-      void fragment_thread(fragment_atomic_queue_t& fragment_queue,
-                           std::atomic<bool>& fragments_done) {
-          std::vector<IntervalPoint> intervalPoints;
-          std::vector<L1_candidateLocus_t> l1Mappings;
-          MappingResultsVector_t l2Mappings;
-          QueryMetaData<MinVec_Type> Q;
-
-          while (!fragments_done.load()) {
-              FragmentData* fragment = nullptr;
-              if (fragment_queue.try_pop(fragment)) {
-                  if (fragment) {
-                      processFragment(fragment, intervalPoints, l1Mappings, l2Mappings, Q);
-                  }
-              } else {
-                  std::this_thread::sleep_for(std::chrono::milliseconds(10));
-              }
-          }
+        delete input;
+        merged_queue.push(output);
       }
 
       void processAggregatedMappings(const std::string& queryName, MappingResultsVector_t& mappings, progress_meter::ProgressMeter& progress) {
@@ -1043,58 +1272,16 @@ namespace skch
       }
 
       void aggregator_thread(merged_mappings_queue_t& merged_queue,
-                             std::atomic<bool>& workers_done,
-                             std::unordered_map<seqno_t, MappingResultsVector_t>& combinedMappings) {
-          while (true) {
-              QueryMappingOutput* output = nullptr;
-              if (merged_queue.try_pop(output)) {
-                  seqno_t querySeqId = idManager->getSequenceId(output->queryName);
-                  auto& mappings = output->results;
-                  // Chain IDs are already compacted in mapModule
-                  combinedMappings[querySeqId].insert(
-                      combinedMappings[querySeqId].end(),
-                      mappings.begin(),
-                      mappings.end()
-                  );
-                  delete output;
-              } else if (workers_done.load() && merged_queue.was_empty()) {
-                  break;
-              } else {
-                  std::this_thread::sleep_for(std::chrono::milliseconds(10));
-              }
+                             MappingRunStore& combinedMappings) {
+          QueryMappingOutput* output = nullptr;
+          while (merged_queue.pop(output)) {
+              seqno_t querySeqId = idManager->getSequenceId(output->queryName);
+              // Chain IDs are already compacted in mapModule
+              combinedMappings.add(querySeqId, std::move(output->results));
+              delete output;
           }
       }
 
-      /**
-       * @brief                       routine to handle mapModule's output of mappings
-       * @param[in] output            mapping output object
-       * @param[in] allReadMappings   vector to store mappings of all reads (optional use depending on filter)
-       * @param[in] totalReadsMapped  counter to track count of reads mapped
-       * @param[in] outstrm           outstream stream object
-       */
-      template <typename Vec>
-      void mapModuleHandleOutput(MapModuleOutput* output,
-                                 Vec &allReadMappings,
-                                 seqno_t &totalReadsMapped,
-                                 std::ofstream &outstrm) {
-
-          if(output->readMappings.size() > 0)
-            totalReadsMapped++;
-
-          if (param.filterMode == filter::ONETOONE)
-          {
-            //Save for another filtering round
-            allReadMappings.insert(allReadMappings.end(), output->readMappings.begin(), output->readMappings.end());
-          }
-          else
-          {
-            //Report mapping
-            reportReadMappings(output->readMappings, output->qseqName, outstrm);
-          }
-
-          delete output;
-        }
-
       /**
        * @brief                       Filter non-merged mappings
        * @param[in/out] readMappings  Mappings computed by Mashmap
@@ -1138,9 +1325,10 @@ namespace skch
           {
             if (param.skip_prefix)
             {
-              int currGroup = this->idManager->getRefGroup(l1_begin->seqId);
-              l1_end = std::find_if_not(l1_begin, l1Mappings.end(), [this, currGroup] (const auto& candidate) {
-                  return currGroup == this->idManager->getRefGroup(candidate.seqId);
+              const std::vector<int>& groups = this->idManager->getRefGroups();
+              int currGroup = groups[l1_begin->seqId];
+              l1_end = std::find_if_not(l1_begin, l1Mappings.end(), [&groups, currGroup] (const auto& candidate) {
+                  return currGroup == groups[candidate.seqId];
               });
             }
             else
@@ -1181,7 +1369,7 @@ namespace skch
         void getSeedHits(Q_Info &Q)
         {
           Q.minmerTableQuery.reserve(param.sketchSize + 1);
-          CommonFunc::sketchSequence(Q.minmerTableQuery, Q.seq, Q.len, param.kmerSize, param.alphabetSize, param.sketchSize, Q.seqId);
+          CommonFunc::sketchSequence(Q.minmerTableQuery, Q.seq, Q.len, param.kmerSize, param.alphabetSize, param.kmerHash, param.sketchSize, Q.seqId);
           if(Q.minmerTableQuery.size() == 0) {
             Q.sketchSize = 0;
             return;
@@ -1225,52 +1413,69 @@ namespace skch
           if(Q.minmerTableQuery.size() == 0)
             return;
 
-          // Priority queue for sorting interval points
-          using IP_const_iterator = std::vector<IntervalPoint>::const_iterator;
-          std::vector<boundPtr<IP_const_iterator>> pq;
-          pq.reserve(Q.sketchSize);
-          constexpr auto heap_cmp = [](const auto& a, const auto& b) {return b < a;};
-
-          for(auto it = Q.minmerTableQuery.begin(); it != Q.minmerTableQuery.end(); it++)
+          // Slices of the seed hashes in the flat lookup index, to be merged
+          // into sorted interval points
+          static thread_local std::vector<SeedSlice> pq;
+          pq.clear();
+
+          //Batched lookup: prefetch the filter blocks of all the minmers, then
+          //the table slots of those that pass, then resolve the slots, so that
+          //the cache misses of a fragment overlap instead of being serialized
+          const SeedFilter& filter = refSketch->seedFilter;
+          const PosListIndex& lookupIndex = refSketch->minmerPosLookupIndex;
+          static thread_local std::vector<hash_t> seedHashes;
+          seedHashes.clear();
+          for (const auto& mi : Q.minmerTableQuery)
           {
-            //Check if hash value exists in the reference lookup index
-            const auto seedFind = refSketch->minmerPosLookupIndex.find(it->hash);
-
-            if(seedFind != refSketch->minmerPosLookupIndex.end())
-            {
-              pq.emplace_back(boundPtr<IP_const_iterator> {seedFind->second.cbegin(), seedFind->second.cend()});
-            }
+            filter.prefetch(mi.hash);
           }
-          std::make_heap(pq.begin(), pq.end(), heap_cmp);
-
-          while(!pq.empty())
+          for (const auto& mi : Q.minmerTableQuery)
           {
-            const IP_const_iterator ip_it = pq.front().it;
-            //const auto& ref = this->sketch_metadata[ip_it->seqId];
-            const auto& ref_name = this->idManager->getSequenceName(ip_it->seqId);
-            //const auto& ref_len = this->idManager.getSeqLen(ip_it->seqId);
-            bool skip_mapping = false;
-            int queryGroup = idManager->getRefGroup(Q.seqId);
-            int targetGroup = idManager->getRefGroup(ip_it->seqId);
-
-            if (param.skip_self && queryGroup == targetGroup) skip_mapping = true;
-            if (param.skip_prefix && queryGroup == targetGroup) skip_mapping = true;
-            if (param.lower_triangular && Q.seqId <= ip_it->seqId) skip_mapping = true;
-    
-            if (!skip_mapping) {
-              intervalPoints.push_back(*ip_it);
-            }
-            std::pop_heap(pq.begin(), pq.end(), heap_cmp);
-            pq.back().it++;
-            if (pq.back().it >= pq.back().end) 
+            if (filter.mayContain(mi.hash))
             {
-              pq.pop_back();
+              lookupIndex.prefetch(mi.hash);
+              seedHashes.push_back(mi.hash);
             }
-            else
+          }
+          for (hash_t hash : seedHashes)
+          {
+            const auto seedFind = lookupIndex.find(hash);
+            if(seedFind.first != seedFind.second)
             {
-              std::push_heap(pq.begin(), pq.end(), heap_cmp);
+              __builtin_prefetch(seedFind.first);
+              pq.emplace_back(SeedSlice {seedFind.first, seedFind.second, hash});
             }
           }
+          if (param.verbose)
+          {
+            seedLookups += Q.minmerTableQuery.size();
+            seedFilterPasses += seedHashes.size();
+            seedHits += pq.size();
+          }
+
+          //Drop the hits this query may not map to before merging
+          const bool skipGroup = param.skip_self || param.skip_prefix;
+          if (skipGroup || param.lower_triangular || sparsifyPairs())
+          {
+            excludeSeedHits(Q.seqId, skipGroup, param.lower_triangular, pq);
+          }
+
+          auto emitPoint = [&](const IntervalPoint& ip) {
+            intervalPoints.push_back(ip);
+          };
+
+          //Many hits are cheaper to sort at once than to merge one by one
+          uint64_t totalHits = 0;
+          for (const auto& slice : pq)
+          {
+            totalHits += slice.end - slice.it;
+          }
+          if (totalHits >= skch::fixed::radix_merge_min_points && radixMergeSeedSlices(pq, emitPoint))
+          {
+            return;
+          }
+
+          heapMergeSeedSlices(pq, emitPoint);
 
 #ifdef DEBUG
           std::cerr << "INFO, wfmash::mashmap, read id " << Q.seqId << ", Count of seed hits in the reference = " << intervalPoints.size() / 2 << "\n";
@@ -1278,6 +1483,103 @@ namespace skch
         }
 
 
+      /**
+       * @brief                   spread a hash uniformly over 64 bits (splitmix64
+       *                          finalizer) before comparing it to sparsity_hash_threshold
+       */
+      static uint64_t mixSparsityHash(uint64_t h)
+      {
+        h += 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        return h ^ (h >> 31);
+      }
+
+      /**
+       * @brief                   true if --sparsification drops (query, target)
+       *                          pairs before mapping rather than mappings after it
+       */
+      bool sparsifyPairs() const
+      {
+        return param.sparsify_pairs && param.sparsity_hash_threshold < std::numeric_limits<uint64_t>::max();
+      }
+
+      /**
+       * @brief                   whether early sparsification keeps a pair of sequences
+       * @details                 The pair hash is symmetric, so all-vs-all mapping keeps
+       *                          or drops both directions of a pair, and uniform, so a
+       *                          fraction sparsity_hash_threshold / 2^64 of the pairs is kept.
+       */
+      bool keepSequencePair(seqno_t querySeqId, seqno_t refSeqId) const
+      {
+        uint64_t lo = uint32_t(std::min(querySeqId, refSeqId));
+        uint64_t hi = uint32_t(std::max(querySeqId, refSeqId));
+        return mixSparsityHash((hi << 32) | lo) <= param.sparsity_hash_threshold;
+      }
+
+      /**
+       * @brief                   remove the points of seed slices that a query may
+       *                          not map to, and the slices left empty
+       * @details                 Kept points are copied to a buffer of the calling
+       *                          thread, valid until its next call. Slices are sorted
+       *                          by sequence, so -L trims their ends, and the group
+       *                          and pair sparsification of a sequence are only
+       *                          looked up at its first point.
+       * @param[in]   querySeqId  query sequence
+       * @param[in]   skipGroup   drop targets in the query's group
+       * @param[in]   lowerTriangular   drop targets with an id at least the query's
+       * @param[in,out] slices    SeedSlice ranges of interval points
+       */
+      template <typename Slices>
+        void excludeSeedHits(seqno_t querySeqId, bool skipGroup, bool lowerTriangular, Slices& slices)
+        {
+          const std::vector<int>& groups = idManager->getRefGroups();
+          const int queryGroup = groups[querySeqId];
+          const bool sparsify = sparsifyPairs();
+          static thread_local std::vector<PackedIntervalPoint> keptPoints;
+
+          uint64_t totalHits = 0;
+          for (const auto& slice : slices)
+          {
+            totalHits += slice.end - slice.it;
+          }
+          keptPoints.clear();
+          keptPoints.reserve(totalHits);
+
+          size_t kept = 0;
+          for (const auto& slice : slices)
+          {
+            auto end = slice.end;
+            if (lowerTriangular)
+            {
+              end = std::partition_point(slice.it, slice.end,
+                  [querySeqId](const PackedIntervalPoint& p) { return p.seqId() < querySeqId; });
+            }
+            size_t first = keptPoints.size();
+            seqno_t lastSeqId = -1;
+            bool keep = true;
+            for (auto it = slice.it; it != end; it++)
+            {
+              if ((skipGroup || sparsify) && it->seqId() != lastSeqId)
+              {
+                lastSeqId = it->seqId();
+                keep = (!skipGroup || groups[lastSeqId] != queryGroup)
+                  && (!sparsify || keepSequencePair(querySeqId, lastSeqId));
+              }
+              if (keep)
+                keptPoints.push_back(*it);
+            }
+            if (keptPoints.size() != first)
+            {
+              slices[kept] = slice;
+              slices[kept].it = keptPoints.data() + first;
+              slices[kept].end = keptPoints.data() + keptPoints.size();
+              kept++;
+            }
+          }
+          slices.resize(kept);
+        }
+
       template <typename Q_Info, typename IP_iter, typename Vec2>
         void computeL1CandidateRegions(
             Q_Info &Q, 
@@ -1501,9 +1803,6 @@ namespace skch
       template <typename Q_Info, typename IPVec, typename L1Vec>
         void doL1Mapping(Q_Info &Q, IPVec& intervalPoints, L1Vec& l1Mappings)
         {
-          //1. Compute the minmers
-          getSeedHits(Q);
-
           //Catch all NNNNNN case
           if (Q.sketchSize == 0 || Q.kmerComplexity < param.kmerComplexityThreshold) {
             return;
@@ -1527,9 +1826,10 @@ namespace skch
           {
             if (param.skip_prefix)
             {
-              int currGroup = this->idManager->getRefGroup(ip_begin->seqId);
-              ip_end = std::find_if_not(ip_begin, intervalPoints.end(), [this, currGroup] (const auto& ip) {
-                  return currGroup == this->idManager->getRefGroup(ip.seqId);
+              const std::vector<int>& groups = this->idManager->getRefGroups();
+              int currGroup = groups[ip_begin->seqId];
+              ip_end = std::find_if_not(ip_begin, intervalPoints.end(), [&groups, currGroup] (const auto& ip) {
+                  return currGroup == groups[ip.seqId];
               });
             }
             else
@@ -1710,33 +2010,62 @@ namespace skch
           //std::cerr << "INFO, skch::Map:computeL2MappedRegions, read id " << Q.seqName << "_" << Q.startPos << std::endl; 
 #endif
            
-          auto& minmerIndex = refSketch->minmerIndex;
-
           //candidateLocus.rangeStartPos -= param.segLength;
           //candidateLocus.rangeEndPos += param.segLength;
-          
-          // Get first potential mashimizer
-          const MinmerInfo first_minmer = MinmerInfo {0, candidateLocus.rangeStartPos - param.segLength - 1, 0, candidateLocus.seqId, 0};
 
-          //const MinmerInfo first_minmer = MinmerInfo {0, candidateLocus.seqId, -1, 0, 0};
-          auto firstOpenIt = std::lower_bound(minmerIndex.begin(), minmerIndex.end(), first_minmer); 
+          // Timed only with --verbose, two clock reads per candidate are not free
+          auto t0 = param.verbose ? skch::Time::now() : skch::Time::time_point();
+
+          // Get first potential mashimizer, and the end of the windows of its sequence
+          refSketch->forSequenceWindows(candidateLocus.seqId, candidateLocus.rangeStartPos - param.segLength - 1,
+              [&](const auto& windows, uint64_t firstOpen, uint64_t seqWindowsEnd) {
+                sweepL2Windows(Q, candidateLocus, windows, firstOpen, seqWindowsEnd, l2_vec_out);
+              });
+
+          if (param.verbose) {
+              l2Nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(skch::Time::now() - t0).count();
+              l2Candidates++;
+          }
+        }
+
+      /**
+       * @brief                                 L2 sweep over the windows of the candidate's sequence
+       * @param[in]   windows                   WindowRecords or WindowColumnSlice accessor
+       * @param[in]   firstOpen                 first window that may overlap the candidate
+       * @param[in]   seqWindowsEnd             end of the windows of the sequence
+       */
+      template <typename Q_Info, typename Windows, typename Vec>
+        void sweepL2Windows(Q_Info &Q,
+            const L1_candidateLocus_t &candidateLocus,
+            const Windows &windows,
+            uint64_t firstOpen,
+            uint64_t seqWindowsEnd,
+            Vec &l2_vec_out)
+        {
+          // Open window, with what is needed to close it
+          struct OpenWindow
+          {
+            hash_t hash;
+            offset_t wpos_end;
+          };
 
           // Keeps track of the lowest end position
-          std::vector<skch::MinmerInfo> slidingWindow;
-          slidingWindow.reserve(Q.sketchSize);
+          static thread_local std::vector<OpenWindow> slidingWindow;
+          slidingWindow.clear();
 
           // Used to make a min-heap
-          constexpr auto heap_cmp = [](const skch::MinmerInfo& l, const skch::MinmerInfo& r) {return l.wpos_end > r.wpos_end;};
+          constexpr auto heap_cmp = [](const OpenWindow& l, const OpenWindow& r) {return l.wpos_end > r.wpos_end;};
 
           // windowIt keeps track of the end of window
-          auto windowIt = firstOpenIt;
+          uint64_t windowIt = firstOpen;
 
           // Keep track of all minmer windows that intersect with [i, i+windowLen]
           int windowLen = std::max<offset_t>(0, Q.len - param.segLength);
 
           // Used to keep track of how many minmer windows for a particular hash are currently "open"
           // Only necessary when windowLen != 0.
-          std::unordered_map<hash_t, int> hash_to_freq;
+          static thread_local HashCounter hash_to_freq;
+          hash_to_freq.reset();
           
           // slideMap tracks the S(A or B) and S(A) and S(B)
           SlideMapper<Q_Info> slideMap(Q);
@@ -1749,50 +2078,38 @@ namespace skch
           L2_mapLocus_t l2_out = {};
 
           // Set up the window
-          while (windowIt != minmerIndex.end() && windowIt->seqId == candidateLocus.seqId && windowIt->wpos < candidateLocus.rangeStartPos) 
+          while (windowIt != seqWindowsEnd && windows.wpos(windowIt) < candidateLocus.rangeStartPos) 
           {
-            if (windowIt->wpos_end > candidateLocus.rangeStartPos) 
+            if (windows.wposEnd(windowIt) > candidateLocus.rangeStartPos) 
             {
-              if (windowLen > 0) 
-              {
-                hash_to_freq[windowIt->hash]++;
-              }
-              if (windowLen == 0 || hash_to_freq[windowIt->hash] == 1) {
-                slidingWindow.push_back(*windowIt);
+              if (windowLen == 0 || hash_to_freq.increment(windows.hash(windowIt)) == 1) {
+                slidingWindow.push_back(OpenWindow{windows.hash(windowIt), windows.wposEnd(windowIt)});
                 std::push_heap(slidingWindow.begin(), slidingWindow.end(), heap_cmp);
-                slideMap.insert_minmer(*windowIt);
+                slideMap.insert_minmer(windows.hash(windowIt), windows.strand(windowIt));
               }
             }
             windowIt++;
           }
 
-          while (windowIt != minmerIndex.end() && windowIt->seqId == candidateLocus.seqId && windowIt->wpos <= candidateLocus.rangeEndPos + windowLen) 
+          while (windowIt != seqWindowsEnd && windows.wpos(windowIt) <= candidateLocus.rangeEndPos + windowLen) 
           {
             int prev_strand_votes = slideMap.strand_votes;
             bool inserted = false;
-            while (!slidingWindow.empty() && slidingWindow.front().wpos_end <= windowIt->wpos - windowLen) {
+            while (!slidingWindow.empty() && slidingWindow.front().wpos_end <= windows.wpos(windowIt) - windowLen) {
 
               // Remove minmer from end-ordered heap
-              if (windowLen > 0) 
-              {
-                hash_to_freq[slidingWindow.front().hash]--;
-              }
-              if (windowLen == 0 || hash_to_freq[slidingWindow.front().hash] == 0) {
+              if (windowLen == 0 || hash_to_freq.decrement(slidingWindow.front().hash) == 0) {
                 // Remove minmer from  sorted window
-                slideMap.delete_minmer(slidingWindow.front());
+                slideMap.delete_minmer(slidingWindow.front().hash);
                 std::pop_heap(slidingWindow.begin(), slidingWindow.end(), heap_cmp);
                 slidingWindow.pop_back();
               }
 
             }
             inserted = true;
-            if (windowLen > 0) 
-            {
-              hash_to_freq[windowIt->hash]++;
-            }
-            if (windowLen == 0 || hash_to_freq[windowIt->hash] == 1) {
-              slideMap.insert_minmer(*windowIt);
-              slidingWindow.push_back(*windowIt);
+            if (windowLen == 0 || hash_to_freq.increment(windows.hash(windowIt)) == 1) {
+              slideMap.insert_minmer(windows.hash(windowIt), windows.strand(windowIt));
+              slidingWindow.push_back(OpenWindow{windows.hash(windowIt), windows.wposEnd(windowIt)});
               std::push_heap(slidingWindow.begin(), slidingWindow.end(), heap_cmp);
             } else {
               windowIt++;
@@ -1812,8 +2129,8 @@ namespace skch
               l2_out.sharedSketchSize = slideMap.sharedSketchElements;
 
               //Save the position
-              l2_out.optimalStart = windowIt->wpos - windowLen;
-              l2_out.optimalEnd = windowIt->wpos - windowLen;
+              l2_out.optimalStart = windows.wpos(windowIt) - windowLen;
+              l2_out.optimalEnd = windows.wpos(windowIt) - windowLen;
             }
             else if(slideMap.sharedSketchElements == bestSketchSize)
             {
@@ -1821,17 +2138,17 @@ namespace skch
                 l2_out.sharedSketchSize = slideMap.sharedSketchElements;
 
                 //Save the position
-                l2_out.optimalStart = windowIt->wpos - windowLen;
+                l2_out.optimalStart = windows.wpos(windowIt) - windowLen;
               }
 
               in_candidate = true;
               //Still save the position
-              l2_out.optimalEnd = windowIt->wpos - windowLen;
+              l2_out.optimalEnd = windows.wpos(windowIt) - windowLen;
             } else {
               if (in_candidate) {
                 // Save and reset
                 l2_out.meanOptimalPos =  (l2_out.optimalStart + l2_out.optimalEnd) / 2;
-                l2_out.seqId = windowIt->seqId;
+                l2_out.seqId = candidateLocus.seqId;
                 l2_out.strand = prev_strand_votes >= 0 ? strnd::FWD : strnd::REV;
                 if (l2_vec_out.empty() 
                     || l2_vec_out.back().optimalEnd + param.segLength < l2_out.optimalStart)
@@ -1854,7 +2171,7 @@ namespace skch
           if (in_candidate) {
             // Save and reset
             l2_out.meanOptimalPos =  (l2_out.optimalStart + l2_out.optimalEnd) / 2;
-            l2_out.seqId = std::prev(windowIt)->seqId;
+            l2_out.seqId = candidateLocus.seqId;
             l2_out.strand = slideMap.strand_votes >= 0 ? strnd::FWD : strnd::REV;
             if (l2_vec_out.empty() 
                 || l2_vec_out.back().optimalEnd + param.segLength < l2_out.optimalStart)
@@ -2023,57 +2340,131 @@ namespace skch
           // this initializes everything
           auto disjoint_sets = dsets::DisjointSets(ufv.data(), ufv.size());
 
-          //Start the procedure to identify the chains
-          for (auto it = readMappings.begin(); it != readMappings.end(); it++) {
-              double best_score = std::numeric_limits<double>::max();
-              auto best_it2 = readMappings.end();
-              // we we merge only with the best-scored previous mapping in query space
-              if (it->chainPairScore != std::numeric_limits<double>::max()) {
-                  disjoint_sets.unite(it->splitMappingId, it->chainPairId);
+          // Mappings can only chain on the same reference sequence and strand. Within
+          // every (refSeqId, strand) bucket, index the mappings by query start, then by
+          // the reference end they chain from: start on the forward strand, end on the
+          // reverse one
+          struct ChainKey
+          {
+              offset_t queryStart;
+              offset_t refKey;
+              size_t index;
+          };
+          std::vector<ChainKey> bucketed(readMappings.size());
+          for (size_t i = 0; i < readMappings.size(); i++) {
+              const auto& m = readMappings[i];
+              bucketed[i] = ChainKey{m.queryStartPos, m.strand == strnd::FWD ? m.refStartPos : m.refEndPos, i};
+          }
+          std::sort(bucketed.begin(), bucketed.end(), [&readMappings](const ChainKey& a, const ChainKey& b) {
+              const auto& ma = readMappings[a.index];
+              const auto& mb = readMappings[b.index];
+              return std::tie(ma.refSeqId, ma.strand, a.queryStart, a.refKey, a.index)
+                  < std::tie(mb.refSeqId, mb.strand, b.queryStart, b.refKey, b.index);
+          });
+          std::vector<size_t> bucketStarts{0};
+          std::vector<size_t> bucketOf(readMappings.size());
+          for (size_t first = 0; first < bucketed.size();) {
+              const auto& head = readMappings[bucketed[first].index];
+              size_t last = first + 1;
+              while (last < bucketed.size()
+                     && readMappings[bucketed[last].index].refSeqId == head.refSeqId
+                     && readMappings[bucketed[last].index].strand == head.strand) {
+                  last++;
               }
-              for (auto it2 = std::next(it); it2 != readMappings.end(); it2++) {
-                  // If this mapping is for a different reference sequence, ignore
-                  if (it2->refSeqId != it->refSeqId) {
-                      continue;
-                  }
-                  //If this mapping is for exactly the same segment, ignore
-                  if (it2->queryStartPos == it->queryStartPos) {
-                      continue;
-                  }
-                  //If this mapping is too far from current mapping being evaluated in the query, stop finding a merge
-                  if (it2->queryStartPos > it->queryEndPos + max_dist) {
-                      break;
-                  }
-                  //If the next mapping is within range, we can potentially merge
-                  if (it2->strand == it->strand) {
-                      // Always calculate query distance the same way, as query always moves forward
-                      int64_t query_dist = it2->queryStartPos - it->queryEndPos;
+              for (size_t k = first; k < last; k++) {
+                  bucketOf[bucketed[k].index] = bucketStarts.size() - 1;
+              }
+              bucketStarts.push_back(last);
+              first = last;
+          }
+          size_t numBuckets = bucketStarts.size() - 1;
+
+          // The members of every bucket in sorted order, laid out like the buckets
+          std::vector<size_t> members(readMappings.size());
+          {
+              std::vector<size_t> cursor(bucketStarts.begin(), bucketStarts.end() - 1);
+              for (size_t i = 0; i < readMappings.size(); i++) {
+                  members[cursor[bucketOf[i]]++] = i;
+              }
+          }
+          std::vector<size_t> bucketSizes(numBuckets);
+          for (size_t b = 0; b < numBuckets; b++) {
+              bucketSizes[b] = bucketStarts[b+1] - bucketStarts[b];
+          }
+          auto startsAfter = [](const ChainKey& k, offset_t pos) { return k.queryStart < pos; };
+          auto startsBefore = [](offset_t pos, const ChainKey& k) { return pos < k.queryStart; };
+
+          //Start the procedure to identify the chains, in the same order as a scan of all pairs.
+          //Buckets share no mappings, so they are chained in parallel; the sets of a bucket
+          //are united in the same order as in a single scan, which gives the same chain ids
+          parallelForGroups(bucketSizes, [&](size_t firstBucket, size_t lastBucket) {
+              for (size_t b = firstBucket; b < lastBucket; b++) {
+                  auto bucketBegin = bucketed.begin() + bucketStarts[b];
+                  auto bucketEnd = bucketed.begin() + bucketStarts[b+1];
+                  for (size_t k = bucketStarts[b]; k < bucketStarts[b+1]; k++) {
+                      auto it = readMappings.begin() + members[k];
+                      double best_score = std::numeric_limits<double>::max();
+                      auto best_it2 = readMappings.end();
+                      // we we merge only with the best-scored previous mapping in query space
+                      if (it->chainPairScore != std::numeric_limits<double>::max()) {
+                          disjoint_sets.unite(it->splitMappingId, it->chainPairId);
+                      }
 
-                      // Reference distance calculation depends on strand
-                      int64_t ref_dist;
+                      // Candidates start after this segment and its end in the query, at most
+                      // max_dist after its end, and within the reference distance bounds below
+                      auto groupBegin = std::lower_bound(bucketBegin, bucketEnd,
+                          std::max(it->queryStartPos + 1, it->queryEndPos), startsAfter);
+                      auto windowEnd = std::upper_bound(groupBegin, bucketEnd,
+                          it->queryEndPos + max_dist, startsBefore);
+                      offset_t refKeyMin, refKeyMax;
                       if (it->strand == strnd::FWD) {
-                          ref_dist = it2->refStartPos - it->refEndPos;
+                          refKeyMin = it->refEndPos - param.segLength/5;
+                          refKeyMax = it->refEndPos + max_dist;
                       } else {
-                          // For reverse complement, we need to invert the order
-                          ref_dist = it->refStartPos - it2->refEndPos;
+                          refKeyMin = it->refStartPos - max_dist;
+                          refKeyMax = it->refStartPos + param.segLength/5;
                       }
 
-                      // Check if the distance is within acceptable range
-                      if (query_dist >= 0 && ref_dist >= -param.segLength/5 && ref_dist <= max_dist) {
-                          double dist = std::sqrt(std::pow(query_dist, 2) + std::pow(ref_dist, 2));
-                          if (dist < max_dist && best_score > dist && it2->chainPairScore > dist) {
-                              best_it2 = it2;
-                              best_score = dist;
+                      // Scan the candidates of every query start within the window; the best
+                      // is the closest, and the first in sorted order among equally close ones
+                      while (groupBegin != windowEnd) {
+                          auto groupEnd = std::upper_bound(groupBegin, windowEnd, groupBegin->queryStart, startsBefore);
+                          auto cand = std::lower_bound(groupBegin, groupEnd, refKeyMin,
+                              [](const ChainKey& k, offset_t key) { return k.refKey < key; });
+                          for (; cand != groupEnd && cand->refKey <= refKeyMax; cand++) {
+                              auto it2 = readMappings.begin() + cand->index;
+                              // Always calculate query distance the same way, as query always moves forward
+                              int64_t query_dist = it2->queryStartPos - it->queryEndPos;
+
+                              // Reference distance calculation depends on strand
+                              int64_t ref_dist;
+                              if (it->strand == strnd::FWD) {
+                                  ref_dist = it2->refStartPos - it->refEndPos;
+                              } else {
+                                  // For reverse complement, we need to invert the order
+                                  ref_dist = it->refStartPos - it2->refEndPos;
+                              }
+
+                              // Check if the distance is within acceptable range
+                              if (query_dist >= 0 && ref_dist >= -param.segLength/5 && ref_dist <= max_dist) {
+                                  double dist = std::sqrt(std::pow(query_dist, 2) + std::pow(ref_dist, 2));
+                                  if (dist < max_dist && it2->chainPairScore > dist
+                                      && (best_score > dist || (best_score == dist && it2 < best_it2))) {
+                                      best_it2 = it2;
+                                      best_score = dist;
+                                  }
+                              }
                           }
+                          groupBegin = groupEnd;
+                      }
+                      if (best_it2 != readMappings.end()) {
+                          best_it2->chainPairScore = best_score;
+                          best_it2->chainPairId = it->splitMappingId;
                       }
+                      progress.increment(1);
                   }
               }
-              if (best_it2 != readMappings.end()) {
-                  best_it2->chainPairScore = best_score;
-                  best_it2->chainPairId = it->splitMappingId;
-              }
-              progress.increment(1);
-          }
+          });
 
           // Assign the merged mapping ids
           for (auto it = readMappings.begin(); it != readMappings.end(); it++) {
@@ -2089,59 +2480,66 @@ namespace skch
                       < std::tie(b.splitMappingId, b.queryStartPos, b.refSeqId, b.refStartPos, b.strand);
               });
 
-          // Create maximallyMergedMappings
-          MappingResultsVector_t maximallyMergedMappings;
-          for(auto it = readMappings.begin(); it != readMappings.end();) {
-              auto it_end = std::find_if(it, readMappings.end(), [&](const MappingResult &e){return e.splitMappingId != it->splitMappingId;} );
-              MappingResult mergedMapping = *it;  // Copy all fields from the first mapping in the chain
-              mergedMapping.queryStartPos = it->queryStartPos;
-              mergedMapping.queryEndPos = std::prev(it_end)->queryEndPos;
-              mergedMapping.refStartPos = it->refStartPos;
-              mergedMapping.refEndPos = std::prev(it_end)->refEndPos;
-              mergedMapping.blockLength = std::max(mergedMapping.refEndPos - mergedMapping.refStartPos,
-                                                   mergedMapping.queryEndPos - mergedMapping.queryStartPos);
-              mergedMapping.n_merged = std::distance(it, it_end);
-              
-              // Recalculate average values for the merged mapping
-              double totalNucIdentity = 0.0;
-              double totalKmerComplexity = 0.0;
-              int totalConservedSketches = 0;
-              int totalSketchSize = 0;
-              for (auto subIt = it; subIt != it_end; ++subIt) {
-                  totalNucIdentity += subIt->nucIdentity;
-                  totalKmerComplexity += subIt->kmerComplexity;
-                  totalConservedSketches += subIt->conservedSketches;
-                  totalSketchSize += subIt->sketchSize;
+          // Chains are contiguous now; build the merged mapping of every chain and
+          // split the chain, for all chains in parallel
+          std::vector<size_t> chainStarts{0};
+          for (size_t i = 1; i < readMappings.size(); i++) {
+              if (readMappings[i].splitMappingId != readMappings[i-1].splitMappingId) {
+                  chainStarts.push_back(i);
               }
-              mergedMapping.nucIdentity = totalNucIdentity / mergedMapping.n_merged;
-              mergedMapping.kmerComplexity = totalKmerComplexity / mergedMapping.n_merged;
-              mergedMapping.conservedSketches = totalConservedSketches;
-              mergedMapping.sketchSize = totalSketchSize;
-              
-              // Calculate blockNucIdentity
-              mergedMapping.blockNucIdentity = mergedMapping.nucIdentity;
-              
-              // Ensure other fields are properly set
-              mergedMapping.approxMatches = std::round(mergedMapping.nucIdentity * mergedMapping.blockLength / 100.0);
-              mergedMapping.discard = 0;
-              mergedMapping.overlapped = false;
-              mergedMapping.chainPairScore = std::numeric_limits<double>::max();
-              mergedMapping.chainPairId = std::numeric_limits<int64_t>::min();
-
-              maximallyMergedMappings.push_back(mergedMapping);
-              it = it_end;
+          }
+          chainStarts.push_back(readMappings.size());
+          std::vector<size_t> chainSizes(chainStarts.size() - 1);
+          for (size_t c = 0; c < chainSizes.size(); c++) {
+              chainSizes[c] = chainStarts[c+1] - chainStarts[c];
           }
 
-          for(auto it = readMappings.begin(); it != readMappings.end();) {
-              //Bucket by each chain
-              auto it_end = std::find_if(it, readMappings.end(), [&](const MappingResult &e){return e.splitMappingId != it->splitMappingId;} );
+          MappingResultsVector_t maximallyMergedMappings(chainSizes.size());
+          parallelForGroups(chainSizes, [&](size_t firstChain, size_t lastChain) {
+              for (size_t c = firstChain; c < lastChain; c++) {
+                  auto it = readMappings.begin() + chainStarts[c];
+                  auto it_end = readMappings.begin() + chainStarts[c+1];
+                      MappingResult mergedMapping = *it;  // Copy all fields from the first mapping in the chain
+                      mergedMapping.queryStartPos = it->queryStartPos;
+                      mergedMapping.queryEndPos = std::prev(it_end)->queryEndPos;
+                      mergedMapping.refStartPos = it->refStartPos;
+                      mergedMapping.refEndPos = std::prev(it_end)->refEndPos;
+                      mergedMapping.blockLength = std::max(mergedMapping.refEndPos - mergedMapping.refStartPos,
+                                                           mergedMapping.queryEndPos - mergedMapping.queryStartPos);
+                      mergedMapping.n_merged = std::distance(it, it_end);
+              
+                      // Recalculate average values for the merged mapping
+                      double totalNucIdentity = 0.0;
+                      double totalKmerComplexity = 0.0;
+                      int totalConservedSketches = 0;
+                      int totalSketchSize = 0;
+                      for (auto subIt = it; subIt != it_end; ++subIt) {
+                          totalNucIdentity += subIt->nucIdentity;
+                          totalKmerComplexity += subIt->kmerComplexity;
+                          totalConservedSketches += subIt->conservedSketches;
+                          totalSketchSize += subIt->sketchSize;
+                      }
+                      mergedMapping.nucIdentity = totalNucIdentity / mergedMapping.n_merged;
+                      mergedMapping.kmerComplexity = totalKmerComplexity / mergedMapping.n_merged;
+                      mergedMapping.conservedSketches = totalConservedSketches;
+                      mergedMapping.sketchSize = totalSketchSize;
+              
+                      // Calculate blockNucIdentity
+                      mergedMapping.blockNucIdentity = mergedMapping.nucIdentity;
+              
+                      // Ensure other fields are properly set
+                      mergedMapping.approxMatches = std::round(mergedMapping.nucIdentity * mergedMapping.blockLength / 100.0);
+                      mergedMapping.discard = 0;
+                      mergedMapping.overlapped = false;
+                      mergedMapping.chainPairScore = std::numeric_limits<double>::max();
+                      mergedMapping.chainPairId = std::numeric_limits<int64_t>::min();
 
-              // Process the chain into chunks defined by max_mapping_length
-              processChainWithSplits(it, it_end);
+                  maximallyMergedMappings[c] = mergedMapping;
 
-              // Move the iterator to the end of the processed chain
-              it = it_end;
-          }
+                  // Process the chain into chunks defined by max_mapping_length
+                  processChainWithSplits(it, it_end);
+              }
+          });
 
           // After processing all chains, remove discarded mappings
           readMappings.erase(
@@ -2328,16 +2726,17 @@ namespace skch
        * @brief                         Report the final read mappings to output stream
        * @param[in]   readMappings      mapping results for single or multiple reads
        * @param[in]   queryName         input required if reporting one read at a time
-       * @param[in]   outstrm           file output stream object
+       * @param[in]   outstrm           record writer of the output buffer
        */
       void reportReadMappings(MappingResultsVector_t &readMappings, const std::string &queryName,
-          std::ostream &outstrm)
+          wflign::RecordWriter &outstrm)
       {
+        const char sep = param.legacy_output ? ' ' : '\t';
+
         //Print the results
         for(auto &e : readMappings)
         {
           float fakeMapQ = e.nucIdentity == 1 ? 255 : std::round(-10.0 * std::log10(1-(e.nucIdentity)));
-          std::string sep = param.legacy_output ? " " : "\t";
 
           outstrm  << (param.filterMode == filter::ONETOONE ? idManager->getSequenceName(e.querySeqId) : queryName)
                    << sep << e.queryLen
@@ -2367,11 +2766,7 @@ namespace skch
             outstrm << sep << e.nucIdentity * 100.0;
           }
 
-#ifdef DEBUG
-          outstrm << std::endl;
-#else
-          outstrm << "\n";
-#endif
+          outstrm << '\n';
 
           //User defined processing of the results
           if(processMappingResults != nullptr)
@@ -2379,63 +2774,65 @@ namespace skch
         }
       }
 
+      /**
+       * @brief                         Write the header of a binary mapping file,
+       *                                with the names and lengths of all sequences
+       * @param[in]   outstrm           file output stream object
+       */
+      void writeBinaryMappingsHeader(std::ostream &outstrm)
+      {
+        std::vector<std::string> names(idManager->size());
+        std::vector<offset_t> lengths(idManager->size());
+        for (size_t id = 0; id < idManager->size(); id++)
+        {
+          names[id] = idManager->getSequenceName(id);
+          lengths[id] = idManager->getSequenceLength(id);
+        }
+        BinaryMappings::writeHeader(outstrm, param.mergeMappings ? BinaryMappings::FLAG_CHAIN_TAGS : 0, names, lengths);
+      }
+
     private:
-      void processCombinedMappingsThread(aggregate_atomic_queue_t& aggregate_queue, writer_atomic_queue_t& writer_queue, std::atomic<bool>& processing_done, progress_meter::ProgressMeter& progress) {
-          int wait_count = 0;
-          while (true) {
-              std::pair<seqno_t, MappingResultsVector_t*>* task = nullptr;
-              if (aggregate_queue.try_pop(task)) {
-                  wait_count = 0;
-                  auto querySeqId = task->first;
-                  auto& mappings = *(task->second);
-                  
-                  std::string queryName = idManager->getSequenceName(querySeqId);
-                  // Final filtering pass on pre-filtered mappings
-                  if (param.filterMode == filter::MAP || param.filterMode == filter::ONETOONE) {
-                      MappingResultsVector_t filteredMappings;
-                      filterByGroup(mappings, filteredMappings, param.numMappingsForSegment - 1, 
-                                  param.filterMode == filter::ONETOONE, *idManager, progress);
-                      mappings = std::move(filteredMappings);
-                  }
+      void processCombinedMappings(seqno_t querySeqId, MappingResultsVector_t& mappings,
+                                   writer_queue_t& writer_queue, progress_meter::ProgressMeter& progress) {
+          std::string queryName = idManager->getSequenceName(querySeqId);
+          {
+              // Released before the mappings are handed on, which may block
+              ThreadBudget::Permit permit(threadBudget);
+              sparsifyMappings(mappings);
+
+              // Final filtering pass on pre-filtered mappings
+              if (param.filterMode == filter::MAP || param.filterMode == filter::ONETOONE) {
+                  MappingResultsVector_t filteredMappings;
+                  filterByGroup(mappings, filteredMappings, param.numMappingsForSegment - 1, 
+                              param.filterMode == filter::ONETOONE, *idManager, progress);
+                  mappings = std::move(filteredMappings);
+              }
+          }
 
-                  std::stringstream ss;
-                  reportReadMappings(mappings, queryName, ss);
-                  
-                  auto* output = new std::string(ss.str());
-                  while (!writer_queue.try_push(output)) {
-                      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                  }
-                  delete task;
-              } else {
-                  if (processing_done.load() && aggregate_queue.was_empty()) {
-                      ++wait_count;
-                  }
-                  if (wait_count > 10) {
-                      break;
-                  }
-                  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          if (processQueryMappings != nullptr) {
+              processQueryMappings(mappings, *idManager);
+              return;
+          }
+
+          std::string* output = outputBuffers.get();
+          if (param.binaryMappings) {
+              BinaryMappings::append(*output, mappings);
+              if (processMappingResults != nullptr) {
+                  std::for_each(mappings.begin(), mappings.end(), processMappingResults);
               }
+          } else {
+              wflign::RecordWriter record(*output);
+              reportReadMappings(mappings, queryName, record);
           }
+
+          writer_queue.push(output);
       }
 
-      void outputThread(std::ofstream& outstrm, writer_atomic_queue_t& writer_queue, std::atomic<bool>& processing_done,
-                        std::atomic<bool>& workers_done, std::atomic<bool>& output_done) {
-          int wait_count = 0;
-          while (!output_done.load()) {
-              std::string* result = nullptr;
-              if (writer_queue.try_pop(result)) {
-                  wait_count = 0;
-                  outstrm << *result;
-                  delete result;
-              } else {
-                  if (processing_done.load() && workers_done.load() && writer_queue.was_empty()) {
-                      ++wait_count;
-                  }
-                  if (wait_count > 10) {
-                      output_done.store(true);
-                  }
-                  std::this_thread::sleep_for(std::chrono::milliseconds(10));
-              }
+      void outputThread(std::ofstream& outstrm, writer_queue_t& writer_queue) {
+          std::string* result = nullptr;
+          while (writer_queue.pop(result)) {
+              outstrm.write(result->data(), result->size());
+              outputBuffers.put(result);
           }
       }
 
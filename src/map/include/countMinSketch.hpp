@@ -0,0 +1,92 @@
+/**
+ * @file    countMinSketch.hpp
+ * @brief   fixed memory k-mer frequency estimates for the -F filter
+ */
+
+#ifndef SKETCH_COUNT_MIN_SKETCH_HPP
+#define SKETCH_COUNT_MIN_SKETCH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+//Own includes
+#include "map/include/base_types.hpp"
+
+namespace skch
+{
+  /**
+   * @class     skch::CountMinSketch
+   * @brief     count-min sketch with saturating 32-bit counters
+   * @details   Estimates never fall below the true count, so a hash whose
+   *            estimate is at most a threshold is certainly not frequent; only
+   *            the others need an exact count. Rows are indexed by multiply-shift
+   *            hashing, which uses every bit of the minmer hash (its leading bits
+   *            are mostly zero). add() may be called from several threads.
+   */
+  class CountMinSketch
+  {
+    private:
+
+      static constexpr size_t DEPTH = 4;
+      static constexpr uint32_t MIN_WIDTH_BITS = 10;
+      static constexpr uint64_t ROW_MULTIPLIERS[DEPTH] = {
+        0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL};
+
+      std::unique_ptr<std::atomic<uint32_t>[]> counters;
+      uint32_t widthBits = 0;
+
+      inline size_t column(hash_t hash, size_t row) const
+      {
+        return size_t((hash * ROW_MULTIPLIERS[row]) >> (64 - widthBits));
+      }
+
+    public:
+
+      //Smallest sketch, one 4 KiB row per hash function
+      static constexpr uint64_t MIN_BYTES = (uint64_t(DEPTH) << MIN_WIDTH_BITS) * sizeof(uint32_t);
+
+      /**
+       * @brief     largest sketch that fits in maxBytes, which must be at least MIN_BYTES
+       */
+      explicit CountMinSketch(uint64_t maxBytes)
+      {
+        widthBits = MIN_WIDTH_BITS;
+        while ((uint64_t(2) << widthBits) * DEPTH * sizeof(uint32_t) <= maxBytes && widthBits < 40)
+          widthBits++;
+        size_t n = DEPTH << widthBits;
+        counters.reset(new std::atomic<uint32_t>[n]);
+        for (size_t i = 0; i < n; i++)
+          counters[i].store(0, std::memory_order_relaxed);
+      }
+
+      inline void add(hash_t hash)
+      {
+        for (size_t r = 0; r < DEPTH; r++)
+        {
+          std::atomic<uint32_t>& c = counters[(r << widthBits) + column(hash, r)];
+          uint32_t v = c.load(std::memory_order_relaxed);
+          while (v != std::numeric_limits<uint32_t>::max()
+                 && !c.compare_exchange_weak(v, v + 1, std::memory_order_relaxed))
+            ;
+        }
+      }
+
+      inline uint64_t estimate(hash_t hash) const
+      {
+        uint32_t e = std::numeric_limits<uint32_t>::max();
+        for (size_t r = 0; r < DEPTH; r++)
+          e = std::min(e, counters[(r << widthBits) + column(hash, r)].load(std::memory_order_relaxed));
+        return e;
+      }
+
+      uint64_t bytes() const
+      {
+        return (uint64_t(DEPTH) << widthBits) * sizeof(uint32_t);
+      }
+  };
+}
+
+#endif
@@ -9,7 +9,7 @@
 
 #include <vector>
 #include <algorithm>
-#include <set>
+#include <numeric>
 #include <fstream>
 #include <zlib.h>
 #include <iostream>
@@ -18,6 +18,7 @@
 //Own includes
 #include "map/include/base_types.hpp"
 #include "map/include/map_parameters.hpp"
+#include "map/include/sweepStatus.hpp"
 #include "common/progress.hpp"
 
 //External includes
@@ -42,15 +43,25 @@ namespace skch
       {
         MappingResultsVector_t &vec;
 
-        Helper(MappingResultsVector_t &v) : vec(v) {}
+        //Scores of all mappings, computed once
+        std::vector<double> scores;
 
-        double get_score(const int x) const {
-            if (vec[x].blockLength <= 0 || vec[x].blockNucIdentity <= 0) {
-                return std::numeric_limits<double>::lowest();
-            }
-            return vec[x].blockNucIdentity * std::log(static_cast<double>(vec[x].blockLength));
+        //Buffer of markGood
+        std::vector<int> keptIds;
+
+        Helper(MappingResultsVector_t &v) : vec(v), scores(v.size())
+        {
+          for (size_t x = 0; x < vec.size(); x++)
+          {
+            if (vec[x].blockLength <= 0 || vec[x].blockNucIdentity <= 0)
+              scores[x] = std::numeric_limits<double>::lowest();
+            else
+              scores[x] = vec[x].blockNucIdentity * std::log(static_cast<double>(vec[x].blockLength));
+          }
         }
 
+        double get_score(const int x) const { return scores[x]; }
+
         //Greater than comparison by score and begin position
         //used to define order in BST
         bool operator ()(const int x, const int y) const {
@@ -88,7 +99,7 @@ namespace skch
 
         /*
          * @brief                         mark the mappings with maximum score as good (on query seq)
-         * @tparam          Type          std::set type to save mappings (sweep line status container)
+         * @tparam          Type          sweep line status container of segment ids
          * @param[in/out]   L             container with mappings
          */
         template <typename Type>
@@ -100,6 +111,9 @@ namespace skch
             // count how many secondary alignments we keep
             int kept = 0;
 
+            // the kept mappings, which later ones are checked for overlaps with
+            keptIds.clear();
+
             auto it = L.begin();
             for( ; it != L.end(); it++)
             {
@@ -108,9 +122,9 @@ namespace skch
                 }
 
                 vec[*it].discard = 0;
+                keptIds.push_back(*it);
                 ++kept;
             }
-            auto kit = it;
 
             // Skip overlap checking if threshold is 1.0 (allow all overlaps)
             if (overlapThreshold < 1.0) {
@@ -118,8 +132,8 @@ namespace skch
                 for ( ; it != L.end(); it++) {
                     if (it == L.begin()) continue;
                     int idx = *it;
-                    for (auto it2 = L.begin(); it2 != kit; it2++) {
-                        double overlap = get_overlap(idx, *it2);
+                    for (int keptIdx : keptIds) {
+                        double overlap = get_overlap(idx, keptIdx);
                         if (overlap > overlapThreshold) {
                             vec[idx].overlapped = 1;  // Mark as bad if overlaps more than threshold
                             vec[idx].discard = 1;
@@ -166,9 +180,10 @@ namespace skch
      /**
        * @brief                       filter mappings (best for query sequence)
        * @details                     evaluate best cover mapping for each base pair
+       * @tparam        Status        sweep line status container of segment ids
        * @param[in/out] readMappings  Mappings computed by Mashmap
        */
-      template <typename VecIn>
+      template <typename Status = SweepStatus, typename VecIn>
       void liFilterAlgorithm(VecIn &readMappings, int secondaryToKeep, bool dropRand, double overlapThreshold, progress_meter::ProgressMeter& progress)
         {
           if(readMappings.size() <= 1)
@@ -185,13 +200,14 @@ namespace skch
           Helper obj (readMappings);
 
           //Plane sweep status
-          //binary search tree of segment ids, ordered by their scores
-          std::set <int, Helper> bst (obj);
+          //segment ids, ordered by their scores
+          Status bst = makeSweepStatus<Status>(readMappings.size(), obj);
 
           //Event point schedule
           //vector of triplets <position, event type, segment id>
           typedef std::tuple<offset_t, int, int> eventRecord_t;
-          std::vector <eventRecord_t>  eventSchedule (2*readMappings.size());
+          std::vector <eventRecord_t>  eventSchedule;
+          eventSchedule.reserve (2*readMappings.size());
 
           for(int i = 0; i < readMappings.size(); i++)
           {
@@ -256,7 +272,8 @@ namespace skch
           //Event point schedule
           //vector of triplets <position, event type, segment id>
           typedef std::tuple<offset_t, double, int, int> eventRecord_t;
-          std::vector <eventRecord_t>  eventSchedule (2*readMappings.size());
+          std::vector <eventRecord_t>  eventSchedule;
+          eventSchedule.reserve (2*readMappings.size());
 
           for(int i = 0; i < readMappings.size(); i++) {
               eventSchedule.emplace_back (readMappings[i].queryStartPos, obj.get_score(i), event::BEGIN, i);
@@ -300,11 +317,11 @@ namespace skch
        * @param[in]     dropRand         If multiple mappings have the same score, drop randomly
        *                                 until we only have secondaryToKeep secondary mappings
        */
-      template <typename VecIn>
+      template <typename Status = SweepStatus, typename VecIn>
       void filterMappings(VecIn &readMappings, uint16_t secondaryToKeep, bool dropRand, double overlapThreshold, progress_meter::ProgressMeter& progress)
       {
           //Apply the main filtering algorithm to ensure the best mappings across complete axis
-          liFilterAlgorithm(readMappings, secondaryToKeep, dropRand, overlapThreshold, progress);
+          liFilterAlgorithm<Status>(readMappings, secondaryToKeep, dropRand, overlapThreshold, progress);
       }
 
      /**
@@ -331,9 +348,19 @@ namespace skch
       {
         MappingResultsVector_t &vec;
 
-        Helper(MappingResultsVector_t &v) : vec(v) {}
+        //Scores of all mappings, computed once
+        std::vector<double> scores;
+
+        //Buffer of markGood
+        std::vector<int> keptIds;
+
+        Helper(MappingResultsVector_t &v) : vec(v), scores(v.size())
+        {
+          for (size_t x = 0; x < vec.size(); x++)
+            scores[x] = vec[x].blockNucIdentity * log(vec[x].blockLength);
+        }
 
-        double get_score(const int x) const {return vec[x].blockNucIdentity * log(vec[x].blockLength); }
+        double get_score(const int x) const { return scores[x]; }
 
         //Greater than comparison by score and begin position
         //used to define order in BST
@@ -372,7 +399,7 @@ namespace skch
 
         /**
          * @brief                         mark the mappings with maximum score as good (on query seq)
-         * @tparam          Type          std::set type to save mappings (sweep line status container)
+         * @tparam          Type          sweep line status container of segment ids
          * @param[in/out]   L             container with mappings
          */
           template <typename Type>
@@ -384,6 +411,9 @@ namespace skch
             // count how many secondary alignments we keep
             int kept = 0;
 
+            // the kept mappings, which later ones are checked for overlaps with
+            keptIds.clear();
+
             auto it = L.begin();
             for( ; it != L.end(); it++)
             {
@@ -392,9 +422,9 @@ namespace skch
                 }
 
                 vec[*it].discard = 0;
+                keptIds.push_back(*it);
                 ++kept;
             }
-            auto kit = it;
 
             // Skip overlap checking if threshold is 1.0 (allow all overlaps)
             if (overlapThreshold < 1.0) {
@@ -402,8 +432,8 @@ namespace skch
                 for ( ; it != L.end(); it++) {
                     if (it == L.begin()) continue;
                     int idx = *it;
-                    for (auto it2 = L.begin(); it2 != kit; it2++) {
-                        if (get_overlap(idx, *it2) > overlapThreshold) {
+                    for (int keptIdx : keptIds) {
+                        if (get_overlap(idx, keptIdx) > overlapThreshold) {
                             vec[idx].overlapped = 1;  // Mark as bad if overlaps more than threshold
                             vec[idx].discard = 1;
                             break;
@@ -467,16 +497,15 @@ namespace skch
       };
 
       /**
-       * @brief                       filter mappings (best for reference sequence)
+       * @brief                       mark mappings that are not best for the reference sequence
+       *                              by setting their discard flag, without removing them
+       * @tparam        Status        sweep line status container of segment ids
        * @param[in/out] readMappings  Mappings computed by Mashmap (post merge step)
        * @param[in]     refsketch     reference index class object, used to determine ref sequence lengths
        */
-      template <typename VecIn>
-      void filterMappings(VecIn &readMappings, const skch::SequenceIdManager &idManager, uint16_t secondaryToKeep, bool dropRand, double overlapThreshold)
+      template <typename Status = SweepStatus, typename VecIn>
+      void markMappings(VecIn &readMappings, const skch::SequenceIdManager &idManager, uint16_t secondaryToKeep, bool dropRand, double overlapThreshold)
         {
-          if(readMappings.size() <= 1)
-            return;
-
           //Initially mark all mappings as bad
           //Maintain the order of this vector till end of this function
           std::for_each(readMappings.begin(), readMappings.end(), [&](MappingResult &e){ e.discard = 1; });
@@ -485,12 +514,13 @@ namespace skch
           Helper obj (readMappings);
 
           //Plane sweep status
-          //binary search tree of segment ids, ordered by their scores
-          std::set <int, Helper> bst (obj);
+          //segment ids, ordered by their scores
+          Status bst = makeSweepStatus<Status>(readMappings.size(), obj);
 
           //Event point schedule
           //vector of triplets <position, event type, segment id>
-          std::vector <eventRecord_t>  eventSchedule (2*readMappings.size());
+          std::vector <eventRecord_t>  eventSchedule;
+          eventSchedule.reserve (2*readMappings.size());
 
           for(int i = 0; i < readMappings.size(); i++)
           {
@@ -527,6 +557,108 @@ namespace skch
 
             it = it2;
           }
+        }
+
+      /**
+       * @brief                       filter mappings (best for reference sequence)
+       * @param[in/out] readMappings  Mappings computed by Mashmap (post merge step)
+       * @param[in]     refsketch     reference index class object, used to determine ref sequence lengths
+       */
+      template <typename Status = SweepStatus, typename VecIn>
+      void filterMappings(VecIn &readMappings, const skch::SequenceIdManager &idManager, uint16_t secondaryToKeep, bool dropRand, double overlapThreshold)
+        {
+          if(readMappings.size() <= 1)
+            return;
+
+          markMappings<Status>(readMappings, idManager, secondaryToKeep, dropRand, overlapThreshold);
+
+          //Remove bad mappings
+          readMappings.erase(
+              std::remove_if(readMappings.begin(), readMappings.end(), [&](MappingResult &e){ return e.discard == 1; }),
+              readMappings.end());
+        }
+
+      /**
+       * @brief                       split mappings into groups whose plane sweeps are independent
+       * @details                     The sweep never holds mappings of two reference sequences at once,
+       *                              except that the end event of a mapping reaching the last base of a
+       *                              sequence falls on the first base of the next one. Consecutive
+       *                              sequences linked that way stay in the same group, so marking each
+       *                              group separately gives the same result as marking all mappings.
+       * @param[in]     readMappings  Mappings computed by Mashmap (post merge step)
+       * @param[in]     idManager     used to determine ref sequence lengths
+       * @return                      groups of indices into readMappings, each in increasing order
+       */
+      template <typename VecIn>
+      std::vector<std::vector<size_t>> independentSweeps(const VecIn &readMappings, const skch::SequenceIdManager &idManager)
+        {
+          std::vector<size_t> order(readMappings.size());
+          std::iota(order.begin(), order.end(), 0);
+          std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+              return readMappings[a].refSeqId < readMappings[b].refSeqId;
+          });
+
+          std::vector<std::vector<size_t>> groups;
+          bool reachesNext = false;
+          for (size_t i = 0; i < order.size(); i++)
+          {
+            const auto& m = readMappings[order[i]];
+            bool newSequence = i == 0 || m.refSeqId != readMappings[order[i-1]].refSeqId;
+            if (newSequence)
+            {
+              bool linked = i > 0 && reachesNext && m.refSeqId == readMappings[order[i-1]].refSeqId + 1;
+              if (!linked)
+                groups.emplace_back();
+              reachesNext = false;
+            }
+            groups.back().push_back(order[i]);
+            reachesNext = reachesNext || m.refEndPos == idManager.getSequenceLength(m.refSeqId) - 1;
+          }
+
+          for (auto& group : groups)
+            std::sort(group.begin(), group.end());
+          return groups;
+        }
+
+      /**
+       * @brief                       filter mappings (best for reference sequence), marking the
+       *                              groups of independentSweeps separately; same result as
+       *                              filterMappings
+       * @param[in/out] readMappings  Mappings computed by Mashmap (post merge step), order is preserved
+       * @param[in]     idManager     used to determine ref sequence lengths
+       * @param[in]     forGroups     forGroups(groupSizes, fn) calls fn(first, last) on ranges of
+       *                              groups that cover all of them, possibly in parallel
+       */
+      template <typename VecIn, typename ForGroups>
+      void filterMappingsByGroup(VecIn &readMappings, const skch::SequenceIdManager &idManager, uint16_t secondaryToKeep, bool dropRand, double overlapThreshold, const ForGroups& forGroups)
+        {
+          if(readMappings.size() <= 1)
+            return;
+
+          auto groups = independentSweeps(readMappings, idManager);
+          if (groups.size() == 1)
+          {
+            markMappings(readMappings, idManager, secondaryToKeep, dropRand, overlapThreshold);
+          }
+          else
+          {
+            std::vector<size_t> groupSizes(groups.size());
+            for (size_t g = 0; g < groups.size(); g++)
+              groupSizes[g] = groups[g].size();
+
+            forGroups(groupSizes, [&](size_t first, size_t last) {
+                MappingResultsVector_t bucket;
+                for (size_t g = first; g < last; g++)
+                {
+                  bucket.clear();
+                  for (size_t idx : groups[g])
+                    bucket.push_back(readMappings[idx]);
+                  markMappings(bucket, idManager, secondaryToKeep, dropRand, overlapThreshold);
+                  for (size_t i = 0; i < bucket.size(); i++)
+                    readMappings[groups[g][i]] = bucket[i];
+                }
+            });
+          }
 
           //Remove bad mappings
           readMappings.erase(
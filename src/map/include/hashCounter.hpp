@@ -0,0 +1,109 @@
+/**
+ * @file    hashCounter.hpp
+ * @brief   reusable hash -> count table for the L2 sliding window
+ */
+
+#ifndef SKETCH_HASH_COUNTER_HPP
+#define SKETCH_HASH_COUNTER_HPP
+
+#include <cstdint>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+
+namespace skch
+{
+  /**
+   * @class     skch::HashCounter
+   * @brief     open-addressed (linear probing) counts of hashes
+   * @details   Counts stay in place when they drop to zero, so no deletion is
+   *            needed. Slots belong to the current round if stamped with its
+   *            epoch, which makes reset() O(1); the table only grows, so one
+   *            instance per thread stops allocating after the first calls.
+   */
+  class HashCounter
+  {
+    private:
+
+      struct Slot
+      {
+        hash_t hash;
+        uint32_t stamp;                   //slot is used if stamp == epoch
+        int32_t count;
+      };
+
+      std::vector<Slot> slots = std::vector<Slot>(64, Slot{0, 0, 0});
+      size_t mask = 63;
+      size_t used = 0;
+      uint32_t epoch = 1;
+
+      inline size_t find(hash_t hash) const
+      {
+        size_t i = (hash ^ (hash >> 32)) & mask;
+        while (slots[i].stamp == epoch && slots[i].hash != hash)
+          i = (i + 1) & mask;
+        return i;
+      }
+
+      void grow()
+      {
+        std::vector<Slot> old(2 * slots.size(), Slot{0, 0, 0});
+        old.swap(slots);
+        mask = slots.size() - 1;
+        for (const auto& s : old)
+          if (s.stamp == epoch)
+            slots[find(s.hash)] = s;
+      }
+
+      inline Slot& get(hash_t hash)
+      {
+        size_t i = find(hash);
+        if (slots[i].stamp != epoch)
+        {
+          if (2 * (used + 1) > slots.size())
+          {
+            grow();
+            i = find(hash);
+          }
+          slots[i] = Slot{hash, epoch, 0};
+          used++;
+        }
+        return slots[i];
+      }
+
+    public:
+
+      /**
+       * @brief     forget all counts
+       */
+      void reset()
+      {
+        used = 0;
+        if (++epoch == 0)
+        {
+          for (auto& s : slots)
+            s.stamp = 0;
+          epoch = 1;
+        }
+      }
+
+      /**
+       * @return    count of hash after adding one
+       */
+      inline int increment(hash_t hash)
+      {
+        return ++get(hash).count;
+      }
+
+      /**
+       * @return    count of hash after removing one
+       */
+      inline int decrement(hash_t hash)
+      {
+        return --get(hash).count;
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,177 @@
+/**
+ * @file    indexDirectory.hpp
+ * @brief   table of contents appended to multi-subset index files
+ */
+
+#ifndef SKETCH_INDEX_DIRECTORY_HPP
+#define SKETCH_INDEX_DIRECTORY_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+#include "map/include/map_parameters.hpp"
+
+namespace skch
+{
+  /**
+   * @class     skch::IndexDirectory
+   * @brief     offset, size, sketch parameters and target sequences of every
+   *            sub-index in an index file
+   * @details   Stored after the last sub-index, followed by a fixed size trailer
+   *            (directory offset, magic number), so that it is found by seeking
+   *            to the end of the file. Sub-indexes stay readable in sequence by
+   *            readers that ignore the directory; files written before it existed
+   *            simply have none.
+   */
+  class IndexDirectory
+  {
+    public:
+
+      struct Entry
+      {
+        uint64_t offset;                    //first byte of the sub-index header
+        uint64_t size;                      //bytes up to the next sub-index
+        offset_t segLength;
+        int sketchSize;
+        int kmerSize;
+        KmerHash kmerHash;
+        std::vector<std::string> sequences; //target sequences, in index order
+      };
+
+      std::vector<Entry> entries;
+
+    private:
+
+      static constexpr uint64_t DIRECTORY_MAGIC = 0x5845444e49484d57;  //"WMHINDEX"
+      static constexpr uint32_t DIRECTORY_VERSION = 1;
+      static constexpr uint64_t TRAILER_SIZE = 2 * sizeof(uint64_t);
+
+      template <typename T>
+        static void put(std::ostream& out, const T& value)
+        {
+          out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+      template <typename T>
+        static void get(std::istream& in, T& value)
+        {
+          in.read(reinterpret_cast<char*>(&value), sizeof(value));
+        }
+
+    public:
+
+      /**
+       * @brief     read the directory of an index file
+       * @param[out] directoryOffset  first byte of the directory, where the next
+       *                              sub-index goes when appending
+       * @return    false if the file has no directory
+       */
+      bool read(const std::string& filename, uint64_t& directoryOffset)
+      {
+        entries.clear();
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        if (!in)
+          return false;
+        uint64_t fileSize = in.tellg();
+        if (fileSize < TRAILER_SIZE)
+          return false;
+
+        uint64_t magic = 0;
+        in.seekg(fileSize - TRAILER_SIZE);
+        get(in, directoryOffset);
+        get(in, magic);
+        if (!in || magic != DIRECTORY_MAGIC || directoryOffset > fileSize - TRAILER_SIZE)
+          return false;
+
+        in.seekg(directoryOffset);
+        uint32_t version = 0;
+        uint64_t count = 0;
+        get(in, version);
+        get(in, count);
+        if (version > DIRECTORY_VERSION)
+        {
+          std::cerr << "[wfmash::mashmap] Error: index directory version " << version
+                    << " is newer than the supported version " << DIRECTORY_VERSION << std::endl;
+          exit(1);
+        }
+
+        entries.resize(count);
+        for (auto& e : entries)
+        {
+          uint64_t numSequences = 0;
+          get(in, e.offset);
+          get(in, e.size);
+          get(in, e.segLength);
+          get(in, e.sketchSize);
+          get(in, e.kmerSize);
+          get(in, e.kmerHash);
+          get(in, numSequences);
+          if (!in || numSequences > fileSize / sizeof(uint64_t))
+            break;
+          e.sequences.resize(numSequences);
+          for (auto& name : e.sequences)
+          {
+            uint64_t length = 0;
+            get(in, length);
+            if (!in || length > fileSize)
+              break;
+            name.resize(length);
+            in.read(&name[0], length);
+          }
+        }
+        if (!in || in.tellg() > std::streampos(fileSize - TRAILER_SIZE))
+        {
+          std::cerr << "[wfmash::mashmap] Error: index directory of " << filename
+                    << " is truncated or corrupt" << std::endl;
+          exit(1);
+        }
+        return true;
+      }
+
+      /**
+       * @brief     write the directory and the trailer at the current position
+       */
+      void write(std::ostream& out) const
+      {
+        uint64_t directoryOffset = out.tellp();
+        put(out, DIRECTORY_VERSION);
+        put(out, uint64_t(entries.size()));
+        for (const auto& e : entries)
+        {
+          put(out, e.offset);
+          put(out, e.size);
+          put(out, e.segLength);
+          put(out, e.sketchSize);
+          put(out, e.kmerSize);
+          put(out, e.kmerHash);
+          put(out, uint64_t(e.sequences.size()));
+          for (const auto& name : e.sequences)
+          {
+            put(out, uint64_t(name.size()));
+            out.write(name.data(), name.size());
+          }
+        }
+        put(out, directoryOffset);
+        put(out, DIRECTORY_MAGIC);
+      }
+
+      /**
+       * @brief     sub-index built for exactly these target sequences
+       * @return    nullptr if there is none
+       */
+      const Entry* find(const std::vector<std::string>& sequences) const
+      {
+        for (const auto& e : entries)
+          if (e.sequences == sequences)
+            return &e;
+        return nullptr;
+      }
+  };
+}
+
+#endif
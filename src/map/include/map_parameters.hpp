@@ -18,6 +18,14 @@ namespace skch
 {
 
 
+/**
+ * @brief   k-mer hash function used for sketching; stored in the index
+ */
+enum class KmerHash : uint32_t {
+  MURMUR3 = 0,                                        //MurmurHash3 of the k-mer string
+  ROLLING_2BIT = 1                                    //invertible mix of the rolling 2-bit k-mer code
+};
+
 struct ales_params {
   uint32_t weight{} ;
   uint32_t seed_count{};
@@ -32,6 +40,7 @@ struct ales_params {
 struct Parameters
 {
     int kmerSize;                                     //kmer size for sketching
+    KmerHash kmerHash = KmerHash::ROLLING_2BIT;       //k-mer hash function for sketching
     offset_t segLength;                                //For split mapping case, this represents the fragment length
                                                       //for noSplit, it represents minimum read length to multimap
     offset_t block_length;                             // minimum (potentially merged) block to keep if we aren't split
@@ -81,13 +90,18 @@ struct Parameters
     std::vector<ales::spaced_seed> spaced_seeds;      //
     bool world_minimizers;
     uint64_t sparsity_hash_threshold;                 // keep mappings that hash to <= this value
+    bool sparsify_pairs = false;                      // apply sparsity_hash_threshold to (query, target) pairs before mapping
     double overlap_threshold;                         // minimum overlap for a mapping to be considered
 
     bool legacy_output;
+    bool binaryMappings = false;                      // write mappings in the binary interchange format instead of PAF
     //std::unordered_set<std::string> high_freq_kmers;  //
     int64_t index_by_size = std::numeric_limits<int64_t>::max();  // Target total size of sequences for each index subset
     int minimum_hits = -1;  // Minimum number of hits required for L1 filtering (-1 means auto)
     double max_kmer_freq = 0.0002;  // Maximum allowed k-mer frequency fraction (0-1) or count (>1)
+    bool compactWindows = false;    // Store reference windows in compact columns instead of MinmerInfo records
+    uint64_t kmer_count_sketch_bytes = 0;  // Memory for a count-min sketch prefiltering -F counts (0 = count all hashes exactly)
+    bool verbose = false;           // Report per-subset pipeline and index statistics
 };
 
 
@@ -109,6 +123,10 @@ float confidence_interval = 0.95;                   // Confidence interval to re
 float percentage_identity = 0.70;                   // Percent identity in the mapping step
 float ANIDiff = 0.0;                                // Stage 1 ANI diff threshold
 float ANIDiffConf = 0.999;                          // ANI diff confidence
+uint64_t query_sketch_cache_max_ram = 1ULL << 30;  // Cached query sketches larger than this are spilled to disk
+uint32_t max_index_shard_bits = 10;                 // At most 2^10 hash shards when building an index
+uint32_t window_bucket_bits = 12;                   // Reference windows are located through 4 kbp position buckets
+uint64_t radix_merge_min_points = 128;           // Seed hits of a fragment are radix sorted rather than heap merged from this many
 std::string VERSION = "3.5.0";                      // Version of MashMap
 }
 }
@@ -0,0 +1,90 @@
+/**
+ * @file    mappedFile.hpp
+ * @brief   read-only memory mapping of an index file
+ */
+
+#ifndef SKETCH_MAPPED_FILE_HPP
+#define SKETCH_MAPPED_FILE_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace skch
+{
+  /**
+   * @class     skch::MappedFile
+   * @brief     maps a whole file read-only and shared, so that processes reading
+   *            the same index on a node share its pages in the page cache
+   */
+  class MappedFile
+  {
+    private:
+
+      const char* base = nullptr;
+      uint64_t length = 0;
+
+    public:
+
+      explicit MappedFile(const std::string& filename)
+      {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0)
+        {
+          std::cerr << "[wfmash::mashmap] Error: unable to open index file " << filename
+                    << " for mapping: " << std::strerror(errno) << std::endl;
+          exit(1);
+        }
+        length = st.st_size;
+        if (length > 0)
+        {
+          void* addr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+          if (addr == MAP_FAILED)
+          {
+            std::cerr << "[wfmash::mashmap] Error: unable to map index file " << filename
+                      << ": " << std::strerror(errno) << std::endl;
+            exit(1);
+          }
+          base = static_cast<const char*>(addr);
+        }
+        ::close(fd);
+      }
+
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+
+      ~MappedFile()
+      {
+        if (base != nullptr)
+          ::munmap(const_cast<char*>(base), length);
+      }
+
+      const char* data() const { return base; }
+      uint64_t size() const { return length; }
+
+      /**
+       * @brief     typed pointer to count records at byte offset, which must lie
+       *            within the file and be suitably aligned
+       */
+      template <typename T>
+        const T* at(uint64_t offset, uint64_t count) const
+        {
+          if (offset > length || count > (length - offset) / sizeof(T) || offset % alignof(T) != 0)
+          {
+            std::cerr << "[wfmash::mashmap] Error: index file is truncated or corrupt" << std::endl;
+            exit(1);
+          }
+          return reinterpret_cast<const T*>(base + offset);
+        }
+  };
+}
+
+#endif
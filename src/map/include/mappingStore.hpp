@@ -0,0 +1,207 @@
+/**
+ * @file    mappingStore.hpp
+ * @brief   spills the per-query mappings of every target subset to disk and
+ *          merges them back one query at a time
+ */
+
+#ifndef SKETCH_MAPPING_STORE_HPP
+#define SKETCH_MAPPING_STORE_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+
+//External includes
+#include "interface/temp_file.hpp"
+
+namespace skch
+{
+  /**
+   * @class     skch::MappingRunStore
+   * @brief     external-memory store of mappings, one run per target subset
+   * @details   While a subset is mapped, the mappings of each query are appended
+   *            to the run file of that subset as one contiguous chunk. Closing the
+   *            run sorts its directory of chunks by query id. forEachQuery() then
+   *            k-way merges the run directories and loads the mappings of one
+   *            query at a time, concatenated in run order.
+   *            A store that does not spill keeps its mappings in memory; it is
+   *            used when there is a single target subset, and so a single run.
+   */
+  class MappingRunStore
+  {
+    private:
+
+      struct Chunk
+      {
+        seqno_t querySeqId;
+        uint64_t offset;          //byte offset in the run file
+        uint64_t count;           //number of mappings
+      };
+
+      struct Run
+      {
+        std::string filename;
+        std::vector<Chunk> directory;
+      };
+
+      std::vector<Run> runs;
+      std::ofstream out;
+      uint64_t outOffset = 0;
+      uint64_t totalMappings = 0;
+
+      //mappings of each query, if not spilling
+      bool spill;
+      std::vector<std::pair<seqno_t, MappingResultsVector_t>> inMemory;
+
+    public:
+
+      explicit MappingRunStore(bool spill = true) : spill(spill) {}
+      MappingRunStore(const MappingRunStore&) = delete;
+      MappingRunStore& operator=(const MappingRunStore&) = delete;
+
+      ~MappingRunStore()
+      {
+        if (out.is_open())
+          out.close();
+        for (const auto& run : runs)
+          yeet::temp_file::remove(run.filename);
+      }
+
+      /**
+       * @brief     start the run of the next target subset
+       */
+      void beginRun()
+      {
+        if (!spill)
+          return;
+        runs.push_back(Run{yeet::temp_file::create("wfmash-mappings-", ".bin"), {}});
+        out.open(runs.back().filename, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+          std::cerr << "[wfmash::mashmap] Error: unable to open mapping spill file " << runs.back().filename << std::endl;
+          exit(1);
+        }
+        outOffset = 0;
+      }
+
+      /**
+       * @brief     append the mappings of one query to the current run
+       * @details   not thread safe; each query must be added at most once per run
+       */
+      void add(seqno_t querySeqId, MappingResultsVector_t&& mappings)
+      {
+        if (mappings.empty())
+          return;
+        if (!spill)
+        {
+          totalMappings += mappings.size();
+          inMemory.emplace_back(querySeqId, std::move(mappings));
+          return;
+        }
+        static_assert(std::is_trivially_copyable<MappingResult>::value,
+                      "spilled mappings are written as raw bytes");
+        uint64_t bytes = mappings.size() * sizeof(MappingResult);
+        out.write(reinterpret_cast<const char*>(mappings.data()), bytes);
+        runs.back().directory.push_back(Chunk{querySeqId, outOffset, mappings.size()});
+        outOffset += bytes;
+        totalMappings += mappings.size();
+      }
+
+      /**
+       * @brief     finish the current run
+       */
+      void endRun()
+      {
+        if (!spill)
+        {
+          std::sort(inMemory.begin(), inMemory.end(), [](const auto& a, const auto& b) {
+              return a.first < b.first;
+          });
+          return;
+        }
+        out.close();
+        if (!out)
+        {
+          std::cerr << "[wfmash::mashmap] Error: failed to write mapping spill file " << runs.back().filename << std::endl;
+          exit(1);
+        }
+        auto& directory = runs.back().directory;
+        std::sort(directory.begin(), directory.end(), [](const Chunk& a, const Chunk& b) {
+            return a.querySeqId < b.querySeqId;
+        });
+      }
+
+      uint64_t size() const { return totalMappings; }
+
+      /**
+       * @brief     call f(querySeqId, MappingResultsVector_t&&) for every query with
+       *            mappings, in increasing query id order
+       */
+      template <typename F>
+        void forEachQuery(F f)
+        {
+          if (!spill)
+          {
+            for (auto& query : inMemory)
+              f(query.first, std::move(query.second));
+            inMemory.clear();
+            return;
+          }
+
+          std::vector<std::ifstream> in(runs.size());
+          for (size_t r = 0; r < runs.size(); r++)
+          {
+            in[r].open(runs[r].filename, std::ios::binary);
+            if (!in[r])
+            {
+              std::cerr << "[wfmash::mashmap] Error: unable to read mapping spill file " << runs[r].filename << std::endl;
+              exit(1);
+            }
+          }
+
+          // Heap of (query id, run) over the next unread chunk of each run
+          typedef std::pair<seqno_t, size_t> HeapEntry;
+          std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+          std::vector<size_t> next(runs.size(), 0);
+          for (size_t r = 0; r < runs.size(); r++)
+            if (!runs[r].directory.empty())
+              heap.emplace(runs[r].directory.front().querySeqId, r);
+
+          while (!heap.empty())
+          {
+            // Smallest run index first, as runs with equal query ids pop in run order
+            seqno_t querySeqId = heap.top().first;
+            MappingResultsVector_t mappings;
+            while (!heap.empty() && heap.top().first == querySeqId)
+            {
+              size_t r = heap.top().second;
+              heap.pop();
+              const Chunk& chunk = runs[r].directory[next[r]];
+              size_t begin = mappings.size();
+              mappings.resize(begin + chunk.count);
+              static_assert(std::is_trivially_copyable<MappingResult>::value,
+                            "spilled mappings are read back as raw bytes");
+              in[r].seekg(chunk.offset);
+              in[r].read(reinterpret_cast<char*>(mappings.data() + begin), chunk.count * sizeof(MappingResult));
+              if (!in[r])
+              {
+                std::cerr << "[wfmash::mashmap] Error: failed to read mapping spill file " << runs[r].filename << std::endl;
+                exit(1);
+              }
+              if (++next[r] < runs[r].directory.size())
+                heap.emplace(runs[r].directory[next[r]].querySeqId, r);
+            }
+            f(querySeqId, std::move(mappings));
+          }
+        }
+  };
+}
+
+#endif
@@ -0,0 +1,301 @@
+/**
+ * @file    posListIndex.hpp
+ * @brief   immutable hash -> interval point lookup with all position lists
+ *          stored back to back in one array
+ */
+
+#ifndef SKETCH_POS_LIST_INDEX_HPP
+#define SKETCH_POS_LIST_INDEX_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+
+namespace skch
+{
+  /**
+   * @brief   interval point without its hash, which is the lookup key
+   * @details 12 bytes: the position and the sequence id with the side in
+   *          the low bit (1 for OPEN, 0 for CLOSE)
+   */
+#pragma pack(push, 4)
+  struct PackedIntervalPoint
+  {
+    offset_t pos;
+    uint32_t seqSide;
+
+    PackedIntervalPoint() = default;
+
+    PackedIntervalPoint(const IntervalPoint& ip)
+      : pos(ip.pos), seqSide((uint32_t(ip.seqId) << 1) | (ip.side == side::OPEN ? 1 : 0)) {}
+
+    seqno_t seqId() const { return seqno_t(seqSide >> 1); }
+    side_t side() const { return (seqSide & 1) ? side::OPEN : side::CLOSE; }
+
+    IntervalPoint unpack(hash_t hash) const
+    {
+      return IntervalPoint {pos, hash, seqId(), side()};
+    }
+
+    // Same order as IntervalPoint: seqId, then pos, then CLOSE before OPEN
+    bool operator <(const PackedIntervalPoint& x) const {
+      return std::make_tuple(seqSide >> 1, pos, seqSide & 1)
+        < std::make_tuple(x.seqSide >> 1, x.pos, x.seqSide & 1);
+    }
+  };
+#pragma pack(pop)
+
+  static_assert(sizeof(PackedIntervalPoint) == 12, "PackedIntervalPoint must stay packed");
+
+  /**
+   * @class     skch::PosListIndex
+   * @brief     CSR layout of the minmer position lists
+   * @details   All position lists live in a single array, in the order they were
+   *            added. An open-addressed slot table (linear probing, power of two
+   *            size) maps each hash to the offset and length of its list; a slot
+   *            with count 0 is empty. Neither array holds pointers, so both are
+   *            written to the index file as flat blocks, and a mapped index file
+   *            can be attached without copying.
+   *
+   *            The slot table may be split into 2^shardBits equal regions, one
+   *            per shard of the hashes, each probed on its own. Shards own disjoint
+   *            regions of both arrays and are filled independently, in parallel.
+   */
+  class PosListIndex
+  {
+    public:
+
+      struct Slot
+      {
+        hash_t hash;
+        uint64_t offset;            //first point in the points array
+        uint64_t count;             //number of points, 0 if the slot is empty
+      };
+
+      typedef const PackedIntervalPoint* const_iterator;
+
+    private:
+
+      //Storage owned while building, empty if attached to external arrays
+      std::vector<Slot> slots;
+      std::vector<PackedIntervalPoint> points;
+
+      //Arrays used for lookups, either the owned vectors or attached memory
+      const Slot* slotData = nullptr;
+      uint64_t slotCount = 0;
+      const PackedIntervalPoint* pointData = nullptr;
+      uint64_t pointTotal = 0;
+      uint64_t keyCount = 0;
+
+      //Slots per shard region, minus one
+      uint64_t regionMask = 0;
+      uint32_t shardBits = 0;
+
+      void syncViews()
+      {
+        slotData = slots.data();
+        slotCount = slots.size();
+        pointData = points.data();
+        pointTotal = points.size();
+        regionMask = (slotCount >> shardBits) - 1;
+      }
+
+      //First slot probed for hash
+      inline size_t home(hash_t hash) const
+      {
+        //Bits below shardBits are the same within a shard
+        return shardOf(hash) * (regionMask + 1) + (((hash ^ (hash >> 32)) >> shardBits) & regionMask);
+      }
+
+      //Slot holding hash, or the empty slot where it belongs
+      inline size_t probe(hash_t hash) const
+      {
+        size_t base = shardOf(hash) * (regionMask + 1);
+        size_t i = home(hash) - base;
+        while (slotData[base + i].count != 0 && slotData[base + i].hash != hash)
+          i = (i + 1) & regionMask;
+        return base + i;
+      }
+
+      //Make room for one more key, keeping the load factor at most 0.7
+      void reserveKey()
+      {
+        if (10 * (keyCount + 1) <= 7 * slots.size())
+          return;
+        std::vector<Slot> old(std::max<size_t>(16, 2 * slots.size()), Slot{0, 0, 0});
+        old.swap(slots);
+        syncViews();
+        for (const auto& s : old)
+          if (s.count != 0)
+            slots[probe(s.hash)] = s;
+      }
+
+    public:
+
+      /**
+       * @brief     shard of a hash, from its lowest bits
+       * @details   Minmers are the smallest hashes of their windows, so their leading
+       *            bits are mostly zero and cannot be used.
+       */
+      static size_t shardOf(hash_t hash, uint32_t bits)
+      {
+        return size_t(hash & ((hash_t(1) << bits) - 1));
+      }
+
+      inline size_t shardOf(hash_t hash) const
+      {
+        return shardOf(hash, shardBits);
+      }
+
+      /**
+       * @brief     allocate empty storage for filling by fillShard()
+       * @param[in] bits          log2 of the number of shards
+       * @param[in] maxShardKeys  most hashes in any one shard
+       * @param[in] totalPoints   interval points in all shards
+       */
+      void allocateShards(uint32_t bits, uint64_t maxShardKeys, uint64_t totalPoints)
+      {
+        clear();
+        shardBits = bits;
+        size_t regionSize = 16;
+        while (10 * maxShardKeys > 7 * regionSize)
+          regionSize <<= 1;
+        slots.assign(regionSize << shardBits, Slot{0, 0, 0});
+        points.resize(totalPoints);
+        syncViews();
+      }
+
+      /**
+       * @brief     lay out the position lists of one shard
+       * @details   Safe to call concurrently for different shards.
+       * @param[in] lists         hash -> interval points, all hashes of the shard
+       * @param[in] pointOffset   first point of the shard, after all lower shards
+       */
+      template <typename Map>
+        void fillShard(const Map& lists, uint64_t pointOffset)
+        {
+          Slot* slotArray = slots.data();
+          for (const auto& [hash, list] : lists)
+          {
+            if (list.empty())
+              continue;
+            slotArray[probe(hash)] = Slot{hash, pointOffset, uint64_t(list.size())};
+            PackedIntervalPoint* out = points.data() + pointOffset;
+            for (const auto& ip : list)
+              *out++ = PackedIntervalPoint(ip);
+            pointOffset += list.size();
+          }
+        }
+
+      /**
+       * @brief     record the number of hashes once every shard is filled
+       */
+      void finishShards(uint64_t keys)
+      {
+        keyCount = keys;
+      }
+
+      /**
+       * @brief     add the complete list of a hash not added before
+       */
+      void insert(hash_t hash, const IntervalPoint* begin, const IntervalPoint* end)
+      {
+        assert(shardBits == 0);
+        if (begin == end)
+          return;
+        reserveKey();
+        Slot& slot = slots[probe(hash)];
+        slot = Slot{hash, points.size(), uint64_t(end - begin)};
+        keyCount++;
+        for (auto it = begin; it != end; it++)
+          points.emplace_back(*it);
+        syncViews();
+      }
+
+      /**
+       * @brief     use arrays written by slotArray()/pointArray() in place; they
+       *            must outlive this object or the next clear()
+       */
+      void attach(const Slot* slotArray, uint64_t slotArraySize,
+          const PackedIntervalPoint* pointArray, uint64_t pointArraySize, uint64_t keys,
+          uint32_t bits)
+      {
+        clear();
+        shardBits = bits;
+        slotData = slotArray;
+        slotCount = slotArraySize;
+        pointData = pointArray;
+        pointTotal = pointArraySize;
+        regionMask = (slotCount >> shardBits) - 1;
+        keyCount = keys;
+      }
+
+      /**
+       * @brief     position list of a hash, empty range if absent
+       */
+      inline std::pair<const_iterator, const_iterator> find(hash_t hash) const
+      {
+        if (slotCount == 0)
+          return {nullptr, nullptr};
+        const Slot& slot = slotData[probe(hash)];
+        const_iterator begin = pointData + slot.offset;
+        return {begin, begin + slot.count};
+      }
+
+      /**
+       * @brief     start loading the home slot of a hash, ahead of find()
+       */
+      inline void prefetch(hash_t hash) const
+      {
+        if (slotCount != 0)
+          __builtin_prefetch(slotData + home(hash));
+      }
+
+      /**
+       * @brief     call f(hash, begin, end) for every hash
+       */
+      template <typename F>
+        void forEach(F f) const
+        {
+          for (uint64_t i = 0; i < slotCount; i++)
+          {
+            const Slot& slot = slotData[i];
+            if (slot.count != 0)
+              f(slot.hash, pointData + slot.offset, pointData + slot.offset + slot.count);
+          }
+        }
+
+      //Raw arrays, for writing the index
+      uint32_t shardCountBits() const { return shardBits; }
+      const Slot* slotArray() const { return slotData; }
+      uint64_t slotArraySize() const { return slotCount; }
+      const PackedIntervalPoint* pointArray() const { return pointData; }
+
+      //Number of distinct hashes
+      uint64_t size() const { return keyCount; }
+
+      //Total number of interval points
+      uint64_t pointCount() const { return pointTotal; }
+
+      uint64_t bytes() const
+      {
+        return slotCount * sizeof(Slot) + pointTotal * sizeof(PackedIntervalPoint);
+      }
+
+      void clear()
+      {
+        std::vector<Slot>().swap(slots);
+        std::vector<PackedIntervalPoint>().swap(points);
+        keyCount = 0;
+        shardBits = 0;
+        syncViews();
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * @file    querySketchCache.hpp
+ * @brief   keeps the fragment sketches of every query so that they can be
+ *          replayed against each target subset without re-reading the queries
+ */
+
+#ifndef SKETCH_QUERY_CACHE_HPP
+#define SKETCH_QUERY_CACHE_HPP
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+
+//External includes
+#include "interface/temp_file.hpp"
+
+namespace skch
+{
+  /**
+   * @class     skch::QuerySketchCache
+   * @brief     compact store of query fragment sketches
+   * @details   Only what the L1 and L2 stages read from a sketched fragment is
+   *            kept: the minmer hashes and strands, the sketch size and the
+   *            k-mer complexity. Queries are serialized into blobs which are
+   *            either kept in memory or appended to a temporary spill file.
+   */
+  class QuerySketchCache
+  {
+    public:
+
+      struct Fragment
+      {
+        int fragmentIndex;
+        int len;
+        float kmerComplexity;
+        std::vector<hash_t> hashes;         //minmer hashes, in sketch order
+        std::vector<strand_t> strands;      //minmer strands, parallel to hashes
+      };
+
+      struct Query
+      {
+        seqno_t seqId;
+        offset_t len;
+        std::string name;
+        std::vector<Fragment> fragments;
+      };
+
+    private:
+
+      bool spill;
+      std::string spillFilename;
+      std::ofstream spillOut;
+      std::vector<std::string> blobs;       //used if not spilling
+      uint64_t queryCount = 0;
+      uint64_t byteCount = 0;
+      std::mutex mutex;
+
+      template <typename T>
+        static void put(std::string& blob, const T& value)
+        {
+          blob.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+      template <typename T>
+        static void put(std::string& blob, const std::vector<T>& values)
+        {
+          blob.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+        }
+
+      template <typename T>
+        static void get(const char*& ptr, T& value)
+        {
+          std::memcpy(&value, ptr, sizeof(T));
+          ptr += sizeof(T);
+        }
+
+      template <typename T>
+        static void get(const char*& ptr, std::vector<T>& values, size_t count)
+        {
+          values.resize(count);
+          std::memcpy(values.data(), ptr, count * sizeof(T));
+          ptr += count * sizeof(T);
+        }
+
+      static std::string serialize(const Query& q)
+      {
+        std::string blob;
+        put(blob, q.seqId);
+        put(blob, q.len);
+        put(blob, uint32_t(q.name.size()));
+        blob.append(q.name);
+        put(blob, uint32_t(q.fragments.size()));
+        for (const auto& f : q.fragments)
+        {
+          put(blob, f.fragmentIndex);
+          put(blob, f.len);
+          put(blob, f.kmerComplexity);
+          put(blob, uint32_t(f.hashes.size()));
+          put(blob, f.hashes);
+          put(blob, f.strands);
+        }
+        return blob;
+      }
+
+      static void deserialize(const std::string& blob, Query& q)
+      {
+        const char* ptr = blob.data();
+        uint32_t nameLen, fragmentCount;
+        get(ptr, q.seqId);
+        get(ptr, q.len);
+        get(ptr, nameLen);
+        q.name.assign(ptr, nameLen);
+        ptr += nameLen;
+        get(ptr, fragmentCount);
+        q.fragments.resize(fragmentCount);
+        for (auto& f : q.fragments)
+        {
+          uint32_t sketchSize;
+          get(ptr, f.fragmentIndex);
+          get(ptr, f.len);
+          get(ptr, f.kmerComplexity);
+          get(ptr, sketchSize);
+          get(ptr, f.hashes, sketchSize);
+          get(ptr, f.strands, sketchSize);
+        }
+      }
+
+    public:
+
+      /**
+       * @param[in] spill   keep the sketches in a temporary file instead of memory
+       */
+      explicit QuerySketchCache(bool spill) : spill(spill)
+      {
+        if (spill)
+        {
+          spillFilename = yeet::temp_file::create("wfmash-qsketch-", ".bin");
+          spillOut.open(spillFilename, std::ios::binary);
+          if (!spillOut)
+          {
+            std::cerr << "[wfmash::mashmap] Error: unable to open query sketch spill file " << spillFilename << std::endl;
+            exit(1);
+          }
+        }
+      }
+
+      ~QuerySketchCache()
+      {
+        if (spill)
+        {
+          spillOut.close();
+          yeet::temp_file::remove(spillFilename);
+        }
+      }
+
+      /**
+       * @brief     add the fragment sketches of one query; thread safe
+       */
+      void add(const Query& q)
+      {
+        std::string blob = serialize(q);
+        std::lock_guard<std::mutex> lock(mutex);
+        queryCount++;
+        byteCount += blob.size();
+        if (spill)
+        {
+          uint64_t size = blob.size();
+          spillOut.write(reinterpret_cast<const char*>(&size), sizeof(size));
+          spillOut.write(blob.data(), size);
+        }
+        else
+        {
+          blobs.push_back(std::move(blob));
+        }
+      }
+
+      /**
+       * @brief     call f(Query&&) for every stored query, in insertion order
+       * @details   must not run concurrently with add()
+       */
+      template <typename F>
+        void forEach(F f)
+        {
+          Query q;
+          if (!spill)
+          {
+            for (const auto& blob : blobs)
+            {
+              deserialize(blob, q);
+              f(std::move(q));
+            }
+            return;
+          }
+
+          spillOut.flush();
+          std::ifstream in(spillFilename, std::ios::binary);
+          std::string blob;
+          uint64_t size;
+          while (in.read(reinterpret_cast<char*>(&size), sizeof(size)))
+          {
+            blob.resize(size);
+            in.read(&blob[0], size);
+            deserialize(blob, q);
+            f(std::move(q));
+          }
+        }
+
+      uint64_t size() const { return queryCount; }
+      uint64_t bytes() const { return byteCount; }
+      bool spilled() const { return spill; }
+  };
+}
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * @file    radixSort.hpp
+ * @brief   LSD radix sort on integer keys, for merging seed hits
+ */
+
+#ifndef SKETCH_RADIX_SORT_HPP
+#define SKETCH_RADIX_SORT_HPP
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace skch
+{
+  /**
+   * @brief     stable LSD radix sort of items by key(item), 8 bits per pass
+   * @details   The digit histograms of all passes are counted in one read of
+   *            the items, and passes in which every item has the same digit are
+   *            skipped, so keys are only sorted on the bits in which they differ.
+   * @param[in,out] items     items to sort
+   * @param[in,out] scratch   buffer reused between calls
+   * @param[in]     keyBits   keys are below 2^keyBits
+   * @param[in]     key       item -> uint64_t key
+   */
+  template <typename T, typename KeyFn>
+    void radixSort(std::vector<T>& items, std::vector<T>& scratch, uint32_t keyBits, KeyFn key)
+    {
+      constexpr uint32_t DIGIT_BITS = 8;
+      constexpr size_t DIGITS = size_t(1) << DIGIT_BITS;
+      const uint32_t passes = (keyBits + DIGIT_BITS - 1) / DIGIT_BITS;
+      if (items.size() < 2 || passes == 0)
+        return;
+
+      std::array<std::array<uint64_t, DIGITS>, 64 / DIGIT_BITS> counts;
+      for (uint32_t p = 0; p < passes; p++)
+        counts[p].fill(0);
+      for (const T& item : items)
+      {
+        uint64_t k = key(item);
+        for (uint32_t p = 0; p < passes; p++)
+          counts[p][(k >> (p * DIGIT_BITS)) & (DIGITS - 1)]++;
+      }
+
+      scratch.resize(items.size());
+      for (uint32_t p = 0; p < passes; p++)
+      {
+        auto& c = counts[p];
+        uint64_t k0 = key(items.front());
+        if (c[(k0 >> (p * DIGIT_BITS)) & (DIGITS - 1)] == items.size())
+          continue;
+
+        uint64_t offset = 0;
+        for (size_t d = 0; d < DIGITS; d++)
+        {
+          uint64_t n = c[d];
+          c[d] = offset;
+          offset += n;
+        }
+        for (const T& item : items)
+          scratch[c[(key(item) >> (p * DIGIT_BITS)) & (DIGITS - 1)]++] = item;
+        items.swap(scratch);
+      }
+    }
+}
+
+#endif
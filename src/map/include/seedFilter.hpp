@@ -0,0 +1,142 @@
+/**
+ * @file    seedFilter.hpp
+ * @brief   Bloom filter over the hashes of a reference index, checked before
+ *          the position lookup table
+ */
+
+#ifndef SKETCH_SEED_FILTER_HPP
+#define SKETCH_SEED_FILTER_HPP
+
+#include <cstdint>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+
+namespace skch
+{
+  /**
+   * @class     skch::SeedFilter
+   * @brief     split block Bloom filter: a hash sets one bit in each of the
+   *            eight words of one 64-byte block
+   * @details   A lookup touches a single cache line, which can be prefetched
+   *            like a table slot. With at least 10 bits per hash, fewer than
+   *            about 1% of absent hashes pass. The block and the bits come from
+   *            multiply-shift hashing, which uses the random low bits of minmer
+   *            hashes. Like the other index tables, the words can be attached
+   *            from a mapped index file; an empty filter passes every hash.
+   */
+  class SeedFilter
+  {
+    public:
+
+      static constexpr uint64_t BLOCK_WORDS = 8;
+
+    private:
+
+      static constexpr uint64_t BLOCK_MULTIPLIER = 0x9E3779B97F4A7C15ULL;
+      static constexpr uint64_t BIT_MULTIPLIER = 0xC2B2AE3D27D4EB4FULL;
+
+      //Storage owned when built, empty if attached; padded to align the blocks
+      std::vector<uint64_t> words;
+
+      const uint64_t* wordData = nullptr;
+      uint64_t wordTotal = 0;
+      uint64_t blockMask = 0;
+
+      void syncViews()
+      {
+        uintptr_t blockBytes = BLOCK_WORDS * sizeof(uint64_t);
+        uintptr_t start = (reinterpret_cast<uintptr_t>(words.data()) + blockBytes - 1) / blockBytes * blockBytes;
+        wordData = reinterpret_cast<const uint64_t*>(start);
+        wordTotal = words.empty() ? 0 : words.size() - (BLOCK_WORDS - 1);
+        blockMask = wordTotal / BLOCK_WORDS - 1;
+      }
+
+      inline const uint64_t* block(hash_t hash) const
+      {
+        return wordData + (((hash * BLOCK_MULTIPLIER) >> 32) & blockMask) * BLOCK_WORDS;
+      }
+
+      //Bit of word w for hash
+      static inline uint64_t bit(hash_t hash, uint64_t w)
+      {
+        return uint64_t(1) << (((hash * BIT_MULTIPLIER) >> (16 + 6 * w)) & 63);
+      }
+
+    public:
+
+      /**
+       * @brief     allocate an empty filter for up to keys hashes
+       */
+      void allocate(uint64_t keys)
+      {
+        clear();
+        uint64_t blocks = 1;
+        while (blocks * BLOCK_WORDS * 64 < 10 * keys)
+          blocks <<= 1;
+        words.assign(blocks * BLOCK_WORDS + BLOCK_WORDS - 1, 0);
+        syncViews();
+      }
+
+      /**
+       * @brief     add a hash to an allocated filter; safe to call concurrently
+       */
+      inline void insert(hash_t hash)
+      {
+        uint64_t* b = const_cast<uint64_t*>(block(hash));
+        for (uint64_t w = 0; w < BLOCK_WORDS; w++)
+          __atomic_fetch_or(b + w, bit(hash, w), __ATOMIC_RELAXED);
+      }
+
+      /**
+       * @brief     false if the hash was certainly never inserted
+       */
+      inline bool mayContain(hash_t hash) const
+      {
+        if (wordTotal == 0)
+          return true;
+        const uint64_t* b = block(hash);
+        bool found = true;
+        for (uint64_t w = 0; w < BLOCK_WORDS; w++)
+          found &= (b[w] & bit(hash, w)) != 0;
+        return found;
+      }
+
+      inline void prefetch(hash_t hash) const
+      {
+        if (wordTotal != 0)
+          __builtin_prefetch(block(hash));
+      }
+
+      /**
+       * @brief     use words written by wordArray() in place
+       */
+      void attach(const uint64_t* wordArray, uint64_t numWords)
+      {
+        clear();
+        wordData = wordArray;
+        wordTotal = numWords;
+        blockMask = wordTotal / BLOCK_WORDS - 1;
+      }
+
+      //Raw array, for writing the index
+      const uint64_t* wordArray() const { return wordData; }
+      uint64_t wordCount() const { return wordTotal; }
+
+      bool empty() const { return wordTotal == 0; }
+
+      uint64_t bytes() const
+      {
+        return wordTotal * sizeof(uint64_t);
+      }
+
+      void clear()
+      {
+        std::vector<uint64_t>().swap(words);
+        syncViews();
+      }
+  };
+}
+
+#endif
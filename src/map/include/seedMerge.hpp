@@ -0,0 +1,133 @@
+/**
+ * @file    seedMerge.hpp
+ * @brief   merge the position lists of the seed hits of a fragment into one
+ *          sorted stream of interval points
+ */
+
+#ifndef SKETCH_SEED_MERGE_HPP
+#define SKETCH_SEED_MERGE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+#include "map/include/posListIndex.hpp"
+#include "map/include/radixSort.hpp"
+
+namespace skch
+{
+  /**
+   * @brief   contiguous slice of the position list of one seed hash in the
+   *          flat lookup index
+   */
+  struct SeedSlice
+  {
+    PosListIndex::const_iterator it;
+    PosListIndex::const_iterator end;
+    hash_t hash;
+
+    bool operator<(const SeedSlice& other) const {
+      return *it < *(other.it);
+    }
+  };
+
+  /**
+   * @brief                   merge seed slices with a heap of their heads
+   * @details                 Consumes the slices, which are left empty.
+   * @param[in,out] slices    non-empty SeedSlice ranges of interval points
+   * @param[in]   emitPoint   called on every point, in order
+   */
+  template <typename Slices, typename Emit>
+    void heapMergeSeedSlices(Slices& slices, Emit& emitPoint)
+    {
+      constexpr auto heap_cmp = [](const auto& a, const auto& b) {return b < a;};
+
+      std::make_heap(slices.begin(), slices.end(), heap_cmp);
+
+      while(!slices.empty())
+      {
+        emitPoint(slices.front().it->unpack(slices.front().hash));
+        std::pop_heap(slices.begin(), slices.end(), heap_cmp);
+        slices.back().it++;
+        if (slices.back().it >= slices.back().end)
+        {
+          slices.pop_back();
+        }
+        else
+        {
+          std::push_heap(slices.begin(), slices.end(), heap_cmp);
+        }
+      }
+    }
+
+  /**
+   * @brief                   merge seed slices by sorting all their points on a
+   *                          (seqId, pos, side) key with an LSD radix sort
+   * @details                 Equal points keep the order of their slices.
+   * @param[in]   slices      SeedSlice ranges of interval points
+   * @param[in]   emitPoint   called on every point, in order
+   * @return                  false, without emitting anything, if a key does not
+   *                          fit in 64 bits
+   */
+  template <typename Slices, typename Emit>
+    bool radixMergeSeedSlices(const Slices& slices, Emit& emitPoint)
+    {
+      struct KeyedPoint
+      {
+        uint64_t key;
+        hash_t hash;
+      };
+      static thread_local std::vector<KeyedPoint> keyed;
+      static thread_local std::vector<KeyedPoint> scratch;
+
+      offset_t maxPos = 0;
+      uint32_t maxSeqSide = 0;
+      for (const auto& slice : slices)
+      {
+        for (auto it = slice.it; it != slice.end; it++)
+        {
+          if (it->pos < 0)
+            return false;
+          maxPos = std::max(maxPos, it->pos);
+          maxSeqSide = std::max(maxSeqSide, it->seqSide);
+        }
+      }
+      auto bitWidth = [](uint64_t x) {
+        uint32_t bits = 0;
+        for (; x != 0; x >>= 1)
+          bits++;
+        return bits;
+      };
+      const uint32_t posBits = bitWidth(maxPos);
+      const uint32_t keyBits = bitWidth(maxSeqSide >> 1) + posBits + 1;
+      if (keyBits > 64)
+        return false;
+
+      //seqSide holds the sequence id above the side bit, so the key orders
+      //by sequence, then position, then CLOSE before OPEN
+      keyed.clear();
+      for (const auto& slice : slices)
+      {
+        for (auto it = slice.it; it != slice.end; it++)
+        {
+          uint64_t seqSide = it->seqSide;
+          uint64_t key = ((seqSide >> 1) << (posBits + 1)) | (uint64_t(it->pos) << 1) | (seqSide & 1);
+          keyed.push_back(KeyedPoint{key, slice.hash});
+        }
+      }
+      radixSort(keyed, scratch, keyBits, [](const KeyedPoint& p) { return p.key; });
+
+      const uint64_t posMask = (uint64_t(1) << posBits) - 1;
+      for (const auto& p : keyed)
+      {
+        emitPoint(IntervalPoint {
+            offset_t((p.key >> 1) & posMask), p.hash, seqno_t(p.key >> (posBits + 1)),
+            (p.key & 1) ? side::OPEN : side::CLOSE});
+      }
+      return true;
+    }
+}
+
+#endif
@@ -17,6 +17,7 @@ class SequenceIdManager {
 private:
     std::unordered_map<std::string, seqno_t> sequenceNameToId;
     std::vector<ContigInfo> metadata;
+    std::vector<int> groupIds;   // groupId of every sequence, indexed by id
     std::vector<std::string> querySequenceNames;
     std::vector<std::string> targetSequenceNames;
     std::vector<std::string> allPrefixes;
@@ -78,6 +79,9 @@ public:
         throw std::runtime_error("Invalid sequence ID: " + std::to_string(seqId));
     }
 
+    // Group ids of all sequences, for unchecked lookups in hot loops
+    const std::vector<int>& getRefGroups() const { return groupIds; }
+
 private:
     void buildRefGroups() {
         std::vector<std::tuple<std::string, size_t>> seqInfoWithIndex;
@@ -124,6 +128,11 @@ private:
             metadata[originalIndex].groupId = groupMap[groupKey];
         }
 
+        groupIds.resize(totalSeqs);
+        for (size_t i = 0; i < totalSeqs; ++i) {
+            groupIds[i] = metadata[i].groupId;
+        }
+
         if (totalSeqs == 0) {
             std::cerr << "[SequenceIdManager::buildRefGroups] ERROR: No sequences indexed!" << std::endl;
             exit(1);
@@ -123,11 +123,19 @@ namespace skch
       public:
 
         void insert_minmer(const skch::MinmerInfo& mi)
+        {
+          insert_minmer(mi.hash, mi.strand);
+        }
+
+        /**
+         * @brief               insert a reference minmer given by its hash and strand
+         */
+        void insert_minmer(hash_t hash, strand_t strand)
         {
           // Find where minmer goes in vector
           auto insert_loc = std::lower_bound(
               std::next(slidingWindowMinhashes.begin()), slidingWindowMinhashes.end(),
-              mi.hash,
+              hash,
               [](const slidingMapContainerValueType& a, hash_t b) {return a.hash_val < b;});
 
           if (insert_loc == slidingWindowMinhashes.end()) 
@@ -136,9 +144,9 @@ namespace skch
           } 
 
           // If minmer matches, then set curr to active
-          if (insert_loc->hash_val == mi.hash) {
+          if (insert_loc->hash_val == hash) {
             insert_loc->active = true;
-            insert_loc->strand_vote += (insert_loc->q_strand * mi.strand);
+            insert_loc->strand_vote += (insert_loc->q_strand * strand);
             intersectionSize++;
 
             // If minmer matches and is <= pivot, sharedSketchElements++
@@ -169,11 +177,19 @@ namespace skch
          * @param[in]   m       reference minmer to remove
          */
         void delete_minmer(const skch::MinmerInfo& mi)
+        {
+          delete_minmer(mi.hash);
+        }
+
+        /**
+         * @brief               delete a reference minmer given by its hash
+         */
+        void delete_minmer(hash_t hash)
         {
           // Find where minmer goes in vector
           auto insert_loc = std::lower_bound(
               std::next(slidingWindowMinhashes.begin()), slidingWindowMinhashes.end(),
-              mi.hash,
+              hash,
               [](const slidingMapContainerValueType& a, hash_t b) {return a.hash_val < b;});
 
           if (insert_loc == slidingWindowMinhashes.end()) 
@@ -182,7 +198,7 @@ namespace skch
           } 
 
           // If minmer matches, then set curr to inactive
-          if (insert_loc->hash_val == mi.hash) {
+          if (insert_loc->hash_val == hash) {
             // If minmer matches and is <= pivot, sharedSketchElements--
             if (insert_loc->hash_val <= pivot->hash_val) {
               sharedSketchElements--;
@@ -0,0 +1,111 @@
+/**
+ * @file    sweepStatus.hpp
+ * @brief   flat plane sweep status for the mapping filters, replacing a
+ *          std::set of segment ids
+ */
+
+#ifndef SKETCH_SWEEP_STATUS_HPP
+#define SKETCH_SWEEP_STATUS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+namespace skch
+{
+  /**
+   * @class     skch::SweepStatus
+   * @brief     set of segment ids, iterated in a fixed order
+   * @details   All ids are ranked once by the order of the sweep. The members
+   *            are kept as a sorted array of their ranks, with their ids in a
+   *            parallel array, so iterating the status is a scan of the ids.
+   *            An insert or erase moves the members after it; sweep statuses
+   *            hold the few mappings overlapping one position, for which this
+   *            is cheaper than allocating and linking tree nodes.
+   *
+   *            Like std::set with the same comparator, ids that are equivalent
+   *            in the order share a rank: inserting an id whose rank is taken
+   *            does nothing, and erasing an id removes the member of its rank,
+   *            whichever id that is.
+   */
+  class SweepStatus
+  {
+    public:
+
+      typedef const int* const_iterator;
+
+    private:
+
+      std::vector<uint32_t> rankOf;              //id -> rank
+
+      //Members, ordered by rank
+      std::vector<uint32_t> ranks;
+      std::vector<int> ids;
+
+    public:
+
+      /**
+       * @brief     empty status for ids 0 ... n-1
+       * @param[in] before    strict weak order of the ids, the iteration order
+       */
+      template <typename Before>
+        SweepStatus(size_t n, const Before& before)
+        : rankOf(n)
+        {
+          std::vector<int> order(n);
+          std::iota(order.begin(), order.end(), 0);
+          std::stable_sort(order.begin(), order.end(), [&before](int x, int y) { return before(x, y); });
+
+          uint32_t rank = 0;
+          for (size_t i = 0; i < n; i++)
+          {
+            if (i > 0 && before(order[i-1], order[i]))
+              rank++;
+            rankOf[order[i]] = rank;
+          }
+        }
+
+      void insert(int id)
+      {
+        uint32_t rank = rankOf[id];
+        auto pos = std::lower_bound(ranks.begin(), ranks.end(), rank);
+        if (pos != ranks.end() && *pos == rank)
+          return;
+        ids.insert(ids.begin() + (pos - ranks.begin()), id);
+        ranks.insert(pos, rank);
+      }
+
+      void erase(int id)
+      {
+        uint32_t rank = rankOf[id];
+        auto pos = std::lower_bound(ranks.begin(), ranks.end(), rank);
+        if (pos == ranks.end() || *pos != rank)
+          return;
+        ids.erase(ids.begin() + (pos - ranks.begin()));
+        ranks.erase(pos);
+      }
+
+      const_iterator begin() const { return ids.data(); }
+      const_iterator end() const { return ids.data() + ids.size(); }
+
+      size_t size() const { return ids.size(); }
+      bool empty() const { return ids.empty(); }
+  };
+
+  /**
+   * @brief     empty sweep status for ids 0 ... n-1, ordered by before: a
+   *            SweepStatus, or an ordered set such as std::set<int, Before>
+   */
+  template <typename Status, typename Before>
+    Status makeSweepStatus(size_t n, const Before& before)
+    {
+      if constexpr (std::is_constructible<Status, size_t, const Before&>::value)
+        return Status(n, before);
+      else
+        return Status(before);
+    }
+}
+
+#endif
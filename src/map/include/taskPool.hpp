@@ -0,0 +1,305 @@
+/**
+ * @file    taskPool.hpp
+ * @brief   work-stealing task pool driving the query, fragment and
+ *          finalization work of the mapping pipeline
+ */
+
+#ifndef SKETCH_TASK_POOL_HPP
+#define SKETCH_TASK_POOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace skch
+{
+  /**
+   * @class     skch::TaskPool
+   * @brief     fixed set of worker threads executing submitted tasks
+   * @details   Tasks submitted from a worker go to that worker's own deque and
+   *            are executed LIFO, so a worker finishes the fragments it spawned
+   *            before starting new queries. Idle workers steal the oldest task
+   *            of another worker, and only then take externally submitted
+   *            tasks. Workers without work sleep on a condition variable.
+   */
+  class TaskPool
+  {
+    public:
+
+      typedef std::function<void()> Task;
+
+      struct Stats
+      {
+        uint64_t executed = 0;        //tasks run to completion
+        uint64_t stolen = 0;          //tasks taken from another worker's deque
+        uint64_t idleNs = 0;          //time workers spent sleeping, summed over workers
+      };
+
+    private:
+
+      struct WorkerQueue
+      {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> stolen{0};
+        std::atomic<uint64_t> idleNs{0};
+        std::atomic<int64_t> sleepingSince{0};    //steady clock ns, 0 while awake
+      };
+
+      static int64_t nowNs()
+      {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+      }
+
+      std::vector<std::unique_ptr<WorkerQueue>> queues;
+      std::vector<std::thread> threads;
+
+      //Tasks submitted from outside the pool
+      std::mutex sharedMutex;
+      std::deque<Task> sharedTasks;
+
+      //Tasks queued anywhere / submitted but not yet finished
+      std::atomic<int64_t> queued{0};
+      std::atomic<uint64_t> pending{0};
+
+      std::mutex mutex;
+      std::condition_variable wakeup;
+      std::condition_variable allDone;
+      int sleeping = 0;
+      bool stopping = false;
+
+      static inline thread_local TaskPool* currentPool = nullptr;
+      static inline thread_local size_t currentIndex = 0;
+
+      bool popLocal(size_t idx, Task& task)
+      {
+        auto& q = *queues[idx];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty())
+          return false;
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+      }
+
+      bool steal(size_t idx, Task& task)
+      {
+        for (size_t i = 1; i < queues.size(); i++)
+        {
+          auto& q = *queues[(idx + i) % queues.size()];
+          std::lock_guard<std::mutex> lock(q.mutex);
+          if (!q.tasks.empty())
+          {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+          }
+        }
+        return false;
+      }
+
+      bool popShared(Task& task)
+      {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        if (sharedTasks.empty())
+          return false;
+        task = std::move(sharedTasks.front());
+        sharedTasks.pop_front();
+        return true;
+      }
+
+      void execute(Task& task, WorkerQueue* self)
+      {
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        task();
+        if (self != nullptr)
+          self->executed.fetch_add(1, std::memory_order_relaxed);
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          allDone.notify_all();
+        }
+      }
+
+      void workerLoop(size_t idx)
+      {
+        currentPool = this;
+        currentIndex = idx;
+        auto& self = *queues[idx];
+
+        while (true)
+        {
+          Task task;
+          bool found = popLocal(idx, task);
+          if (!found && steal(idx, task))
+          {
+            found = true;
+            self.stolen.fetch_add(1, std::memory_order_relaxed);
+          }
+          if (!found)
+            found = popShared(task);
+
+          if (found)
+          {
+            execute(task, &self);
+            continue;
+          }
+
+          std::unique_lock<std::mutex> lock(mutex);
+          if (queued.load() > 0)
+            continue;
+          if (stopping)
+            break;
+          int64_t start = nowNs();
+          self.sleepingSince.store(start, std::memory_order_relaxed);
+          sleeping++;
+          wakeup.wait(lock, [this] { return stopping || queued.load() > 0; });
+          sleeping--;
+          self.sleepingSince.store(0, std::memory_order_relaxed);
+          self.idleNs.fetch_add(nowNs() - start, std::memory_order_relaxed);
+        }
+      }
+
+    public:
+
+      explicit TaskPool(int threadCount)
+      {
+        size_t n = threadCount > 0 ? threadCount : 1;
+        for (size_t i = 0; i < n; i++)
+          queues.emplace_back(new WorkerQueue());
+        for (size_t i = 0; i < n; i++)
+          threads.emplace_back(&TaskPool::workerLoop, this, i);
+      }
+
+      TaskPool(const TaskPool&) = delete;
+      TaskPool& operator=(const TaskPool&) = delete;
+
+      ~TaskPool()
+      {
+        wait();
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto& t : threads)
+          t.join();
+      }
+
+      /**
+       * @brief     schedule a task; may be called from any thread, including
+       *            from within a running task
+       */
+      void submit(Task task)
+      {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        if (currentPool == this)
+        {
+          auto& q = *queues[currentIndex];
+          std::lock_guard<std::mutex> lock(q.mutex);
+          q.tasks.push_back(std::move(task));
+        }
+        else
+        {
+          std::lock_guard<std::mutex> lock(sharedMutex);
+          sharedTasks.push_back(std::move(task));
+        }
+        queued.fetch_add(1, std::memory_order_release);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (sleeping > 0)
+          wakeup.notify_one();
+      }
+
+      /**
+       * @brief     block until every submitted task, and every task those
+       *            tasks submitted, has finished; must not be called by a worker
+       */
+      void wait()
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        allDone.wait(lock, [this] { return pending.load() == 0; });
+      }
+
+      /**
+       * @brief     run fn(0) ... fn(n-1) in parallel and return once all have finished
+       * @details   May be called from within a task: the caller runs fn(0) and then
+       *            helps with queued tasks instead of blocking a worker.
+       */
+      void parallelFor(size_t n, const std::function<void(size_t)>& fn)
+      {
+        if (n == 0)
+          return;
+        if (n == 1 || threads.size() == 1)
+        {
+          for (size_t i = 0; i < n; i++)
+            fn(i);
+          return;
+        }
+
+        size_t remaining = n;
+        std::mutex doneMutex;
+        std::condition_variable done;
+        auto finish = [&]() {
+          std::lock_guard<std::mutex> lock(doneMutex);
+          if (--remaining == 0)
+            done.notify_all();
+        };
+
+        for (size_t i = 1; i < n; i++)
+          submit([&fn, &finish, i]() { fn(i); finish(); });
+        fn(0);
+        finish();
+
+        // Workers help with their own (and then others') queued tasks while waiting
+        WorkerQueue* self = currentPool == this ? queues[currentIndex].get() : nullptr;
+        std::unique_lock<std::mutex> lock(doneMutex);
+        while (remaining > 0)
+        {
+          Task task;
+          lock.unlock();
+          bool found = self != nullptr && (popLocal(currentIndex, task) || steal(currentIndex, task));
+          if (found)
+            execute(task, self);
+          lock.lock();
+          if (!found)
+            done.wait(lock, [&remaining] { return remaining == 0; });
+        }
+      }
+
+      size_t size() const
+      {
+        return threads.size();
+      }
+
+      /**
+       * @brief     counters summed over all workers, including sleeps in progress
+       */
+      Stats stats() const
+      {
+        Stats total;
+        int64_t now = nowNs();
+        for (const auto& q : queues)
+        {
+          total.executed += q->executed.load(std::memory_order_relaxed);
+          total.stolen += q->stolen.load(std::memory_order_relaxed);
+          total.idleNs += q->idleNs.load(std::memory_order_relaxed);
+          int64_t since = q->sleepingSince.load(std::memory_order_relaxed);
+          if (since > 0 && now > since)
+            total.idleNs += now - since;
+        }
+        return total;
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * @file    threadBudget.hpp
+ * @brief   bound on the threads of the mapper and the aligner that compute at
+ *          the same time, when the mappings are streamed to the aligner
+ */
+
+#ifndef SKETCH_THREAD_BUDGET_HPP
+#define SKETCH_THREAD_BUDGET_HPP
+
+#include <condition_variable>
+#include <mutex>
+
+namespace skch
+{
+  /**
+   * @class     skch::ThreadBudget
+   * @brief     counting semaphore of compute permits, shared by thread pools
+   * @details   A thread holds a permit while it computes, and waits on a
+   *            condition variable while none is free. A permit must be released
+   *            before blocking on a queue, as the consumer of that queue may be
+   *            waiting for the permit.
+   */
+  class ThreadBudget
+  {
+    private:
+
+      std::mutex mutex;
+      std::condition_variable freed;
+      int available;
+
+      static int& heldByThisThread()
+      {
+        static thread_local int held = 0;
+        return held;
+      }
+
+    public:
+
+      explicit ThreadBudget(int threads) : available(threads > 0 ? threads : 1) {}
+
+      ThreadBudget(const ThreadBudget&) = delete;
+      ThreadBudget& operator=(const ThreadBudget&) = delete;
+
+      void acquire()
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        freed.wait(lock, [this] { return available > 0; });
+        available--;
+        heldByThisThread()++;
+      }
+
+      void release()
+      {
+        heldByThisThread()--;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          available++;
+        }
+        freed.notify_one();
+      }
+
+      /**
+       * @brief     whether the calling thread holds a permit, in which case its
+       *            work should not fan out to other threads
+       */
+      static bool held()
+      {
+        return heldByThisThread() > 0;
+      }
+
+      /**
+       * @brief     holds a permit of an optional budget for its lifetime
+       */
+      class Permit
+      {
+        private:
+
+          ThreadBudget* budget;
+
+        public:
+
+          explicit Permit(ThreadBudget* b) : budget(b)
+          {
+            if (budget != nullptr)
+              budget->acquire();
+          }
+
+          Permit(const Permit&) = delete;
+          Permit& operator=(const Permit&) = delete;
+
+          ~Permit()
+          {
+            if (budget != nullptr)
+              budget->release();
+          }
+      };
+  };
+}
+
+#endif
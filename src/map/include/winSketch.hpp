@@ -13,6 +13,8 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
+#include <memory>
+#include <iomanip>
 #include <filesystem>
 namespace fs = std::filesystem;
 
@@ -23,6 +25,13 @@ namespace fs = std::filesystem;
 #include "map/include/map_parameters.hpp"
 #include "map/include/commonFunc.hpp"
 #include "map/include/ThreadPool.hpp"
+#include "map/include/posListIndex.hpp"
+#include "map/include/mappedFile.hpp"
+#include "map/include/indexDirectory.hpp"
+#include "map/include/countMinSketch.hpp"
+#include "map/include/windowOffsetIndex.hpp"
+#include "map/include/windowColumns.hpp"
+#include "map/include/seedFilter.hpp"
 
 //External includes
 #include "common/murmur3.h"
@@ -67,6 +76,21 @@ namespace skch
       //algorithm parameters
       skch::Parameters param;
 
+      //Sub-index header magic numbers. The original layout has no version field
+      //and implies Murmur k-mer hashes; the current one is followed by a version
+      static constexpr uint64_t INDEX_MAGIC_UNVERSIONED = 0xDEADBEEFCAFEBABE;
+      static constexpr uint64_t INDEX_MAGIC = 0xDEADBEEFCAFEBABF;
+      static constexpr uint32_t INDEX_VERSION = 1;
+
+      //Sections of the versioned layout start at multiples of this many bytes in the file
+      static constexpr uint64_t INDEX_SECTION_ALIGN = 64;
+
+      //Section sizes and layout figures preceding the sections
+      static constexpr size_t INDEX_SECTION_SIZES = 11;
+
+      //Whether the sub-index being read has the original unversioned layout
+      bool unversionedIndex = false;
+
       //Make the default constructor protected, non-accessible
       protected:
       Sketch(SequenceIdManager& idMgr) : idManager(idMgr) {}
@@ -77,8 +101,22 @@ namespace skch
       bool isInitialized = false;
 
       using MI_Type = std::vector< MinmerInfo >;
-      using MIIter_t = MI_Type::const_iterator;
+      using MIIter_t = const MinmerInfo*;
+
+      //Read-only view of the minmer windows
+      struct MinmerView
+      {
+        const MinmerInfo* first = nullptr;
+        const MinmerInfo* last = nullptr;
+
+        MIIter_t begin() const { return first; }
+        MIIter_t end() const { return last; }
+        size_t size() const { return last - first; }
+        bool empty() const { return first == last; }
+        const MinmerInfo& operator[](size_t i) const { return first[i]; }
+      };
       using HF_Map_t = ankerl::unordered_dense::map<hash_t, uint64_t>;
+      using HF_Set_t = ankerl::unordered_dense::set<hash_t>;
 
       public:
         uint64_t total_seq_length = 0;
@@ -94,8 +132,22 @@ namespace skch
       //using MI_Map_t = absl::flat_hash_map< MinmerMapKeyType, MinmerMapValueType >;
       //using MI_Map_t = tsl::sparse_map< MinmerMapKeyType, MinmerMapValueType >;
       using MI_Map_t = ankerl::unordered_dense::map< MinmerMapKeyType, MinmerMapValueType >;
-      MI_Map_t minmerPosLookupIndex;
-      MI_Type minmerIndex;
+
+      //Flat lookup built from the per-thread MI_Map_t once the sketch is computed
+      PosListIndex minmerPosLookupIndex;
+
+      //Hashes of minmerPosLookupIndex, to skip lookups of absent ones
+      SeedFilter seedFilter;
+
+      //Minmer windows, in minmerStore or in the mapped index file
+      MinmerView minmerIndex;
+
+      //Range of every sequence in minmerIndex
+      WindowOffsetIndex windowOffsets;
+
+      //Windows in columns, replacing minmerIndex if selected with --compact-windows
+      WindowColumns windowColumns;
+      bool useWindowColumns = false;
 
       // Atomic queues for input and output
       using input_queue_t = atomic_queue::AtomicQueue<InputSeqContainer*, 1024>;
@@ -120,6 +172,42 @@ namespace skch
       // Instance of the SequenceIdManager
       SequenceIdManager& idManager;
 
+      //Minmer windows computed or copied from the index stream
+      MI_Type minmerStore;
+
+      //Index file whose sections are used in place, for versioned indexes
+      std::unique_ptr<MappedFile> indexMapping;
+
+      void useMinmerStore()
+      {
+        minmerIndex = MinmerView{minmerStore.data(), minmerStore.data() + minmerStore.size()};
+        windowOffsets.build(minmerIndex.begin(), minmerIndex.end(), skch::fixed::window_bucket_bits);
+      }
+
+      /**
+       * @brief  Replace the window records by columns, unless a sequence is too
+       *         long for 32-bit relative positions
+       */
+      void convertToWindowColumns()
+      {
+        if (!windowColumns.build(minmerIndex.begin(), minmerIndex.end(), windowOffsets)) {
+          std::cerr << "[wfmash::mashmap] WARNING: a reference sequence spans more than 2^32 bp, "
+                    << "keeping windows as records" << std::endl;
+          return;
+        }
+        useWindowColumns = true;
+        minmerIndex = MinmerView{};
+        MI_Type().swap(minmerStore);
+      }
+
+      /**
+       * @brief  Memory taken by the windows, in whichever layout is used
+       */
+      uint64_t windowBytes() const
+      {
+        return useWindowColumns ? windowColumns.bytes() : windowCount() * sizeof(MinmerInfo);
+      }
+
       public:
 
       /**
@@ -135,6 +223,8 @@ namespace skch
       {
         if (indexStream) {
           readIndex(*indexStream, targets);
+          this->hgNumerator = param.hgNumerator;
+          isInitialized = true;
         } else {
           initialize(targets);
         }
@@ -149,6 +239,21 @@ namespace skch
 
     private:
 
+      /**
+       * @brief     Run f(t) for t in [0, n) on n threads and wait for all of them
+       */
+      template <typename F>
+        static void runThreads(size_t n, F f)
+        {
+          std::vector<std::thread> threads;
+          for (size_t t = 0; t < n; ++t) {
+              threads.emplace_back(f, t);
+          }
+          for (auto& thread : threads) {
+              thread.join();
+          }
+        }
+
       /**
        * @brief     Get sequence metadata and optionally build the sketch table
        *
@@ -231,131 +336,180 @@ namespace skch
               total_windows,
               "[wfmash::mashmap] building index");
 
-          // Parallel k-mer frequency counting
-          std::vector<HF_Map_t> thread_kmer_freqs(param.threads);
-          std::vector<std::thread> freq_threads;
-          
-          // Split outputs into chunks for parallel processing
-          size_t chunk_size = (threadOutputs.size() + param.threads - 1) / param.threads;
-          
-          for (size_t t = 0; t < param.threads; ++t) {
-              freq_threads.emplace_back([&, t]() {
-                  size_t start = t * chunk_size;
-                  size_t end = std::min(start + chunk_size, threadOutputs.size());
-                  
-                  for (size_t i = start; i < end; ++i) {
-                      for (const MinmerInfo& mi : *threadOutputs[i]) {
-                          thread_kmer_freqs[t][mi.hash]++;
-                      }
-                  }
-              });
-          }
-          
-          for (auto& thread : freq_threads) {
-              thread.join();
+          // Each thread owns a contiguous chunk of the sketched sequences, and
+          // each shard the hashes with the same low bits, from counting to layout
+          size_t numThreads = param.threads;
+          size_t chunk_size = (threadOutputs.size() + numThreads - 1) / numThreads;
+          uint32_t shardBits = 0;
+          while ((size_t(1) << shardBits) < 4 * numThreads && shardBits < skch::fixed::max_index_shard_bits) {
+              shardBits++;
           }
+          size_t numShards = size_t(1) << shardBits;
 
-          // Merge frequency maps
-          HF_Map_t kmer_freqs;
-          for (const auto& thread_freq : thread_kmer_freqs) {
-              for (const auto& [hash, freq] : thread_freq) {
-                  kmer_freqs[hash] += freq;
-              }
+          uint64_t min_occ = 10;
+          uint64_t count_threshold;
+          if (param.max_kmer_freq <= 1.0) {
+              count_threshold = std::max(min_occ, (uint64_t)(total_windows * param.max_kmer_freq));
+          } else {
+              count_threshold = std::max(min_occ, (uint64_t)param.max_kmer_freq);
           }
 
-          // Parallel index building
-          std::vector<MI_Map_t> thread_pos_indexes(param.threads);
-          std::vector<MI_Type> thread_minmer_indexes(param.threads);
-          std::vector<uint64_t> thread_total_kmers(param.threads, 0);
-          std::vector<uint64_t> thread_filtered_kmers(param.threads, 0);
-          std::vector<std::thread> index_threads;
-
-          for (size_t t = 0; t < param.threads; ++t) {
-              index_threads.emplace_back([&, t]() {
-                  size_t start = t * chunk_size;
-                  size_t end = std::min(start + chunk_size, threadOutputs.size());
-
-                  for (size_t i = start; i < end; ++i) {
-                      for (const MinmerInfo& mi : *threadOutputs[i]) {
-                          thread_total_kmers[t]++;
-                          
-                          auto freq_it = kmer_freqs.find(mi.hash);
-                          if (freq_it == kmer_freqs.end()) {
-                              continue;  // Should never happen
-                          }
+          // With a memory bound, hashes are counted exactly only if their
+          // count-min estimate, which is never too low, exceeds the threshold
+          std::unique_ptr<CountMinSketch> countSketch;
+          if (param.kmer_count_sketch_bytes > 0) {
+              countSketch = std::make_unique<CountMinSketch>(param.kmer_count_sketch_bytes);
+          }
 
-                          uint64_t freq = freq_it->second;
-                          uint64_t min_occ = 10;
-                          uint64_t max_occ = std::numeric_limits<uint64_t>::max();
-                          uint64_t count_threshold;
-                          
-                          if (param.max_kmer_freq <= 1.0) {
-                              count_threshold = std::min(max_occ, 
-                                                       std::max(min_occ, 
-                                                              (uint64_t)(total_windows * param.max_kmer_freq)));
-                          } else {
-                              count_threshold = std::min(max_occ,
-                                                       std::max(min_occ,
-                                                              (uint64_t)param.max_kmer_freq));
+          // Scatter the windows of every chunk to the shards of their hashes
+          std::vector<std::vector<std::vector<const MinmerInfo*>>> chunk_shards(
+              numThreads, std::vector<std::vector<const MinmerInfo*>>(numShards));
+          runThreads(numThreads, [&](size_t t) {
+              size_t start = std::min(t * chunk_size, threadOutputs.size());
+              size_t end = std::min(start + chunk_size, threadOutputs.size());
+              for (size_t i = start; i < end; ++i) {
+                  for (const MinmerInfo& mi : *threadOutputs[i]) {
+                      chunk_shards[t][PosListIndex::shardOf(mi.hash, shardBits)].push_back(&mi);
+                      if (countSketch) {
+                          countSketch->add(mi.hash);
+                      }
+                  }
+              }
+          });
+
+          // Per shard: count hash frequencies, drop frequent hashes and collect the
+          // position lists of the others. Chunks are visited in sequence order, so
+          // every list comes out sorted.
+          std::vector<MI_Map_t> shard_pos_lists(numShards);
+          std::vector<HF_Set_t> shard_frequent(numShards);
+          std::vector<uint64_t> shard_points(numShards, 0);
+          std::vector<uint64_t> shard_counted(numShards, 0);
+          std::atomic<size_t> next_shard(0);
+          runThreads(numThreads, [&](size_t) {
+              for (size_t s = next_shard++; s < numShards; s = next_shard++) {
+                  HF_Map_t kmer_freqs;
+                  for (size_t t = 0; t < numThreads; ++t) {
+                      for (const MinmerInfo* mi : chunk_shards[t][s]) {
+                          if (!countSketch || countSketch->estimate(mi->hash) > count_threshold) {
+                              kmer_freqs[mi->hash]++;
                           }
-
-                          if (freq > count_threshold && freq > min_occ) {
-                              thread_filtered_kmers[t]++;
+                      }
+                  }
+                  shard_counted[s] = kmer_freqs.size();
+
+                  MI_Map_t& pos_lists = shard_pos_lists[s];
+                  for (size_t t = 0; t < numThreads; ++t) {
+                      for (const MinmerInfo* mi : chunk_shards[t][s]) {
+                          auto freq_it = kmer_freqs.find(mi->hash);
+                          if (freq_it != kmer_freqs.end() && freq_it->second > count_threshold) {
+                              shard_frequent[s].insert(mi->hash);
                               continue;
                           }
-
-                          auto& pos_list = thread_pos_indexes[t][mi.hash];
+                          auto& pos_list = pos_lists[mi->hash];
                           if (pos_list.size() == 0 
-                                  || pos_list.back().hash != mi.hash 
-                                  || pos_list.back().pos != mi.wpos) {
-                              pos_list.push_back(IntervalPoint {mi.wpos, mi.hash, mi.seqId, side::OPEN});
-                              pos_list.push_back(IntervalPoint {mi.wpos_end, mi.hash, mi.seqId, side::CLOSE});
+                                  || pos_list.back().seqId != mi->seqId
+                                  || pos_list.back().pos != mi->wpos) {
+                              pos_list.push_back(IntervalPoint {mi->wpos, mi->hash, mi->seqId, side::OPEN});
+                              pos_list.push_back(IntervalPoint {mi->wpos_end, mi->hash, mi->seqId, side::CLOSE});
+                              shard_points[s] += 2;
                           } else {
-                              pos_list.back().pos = mi.wpos_end;
+                              pos_list.back().pos = mi->wpos_end;
                           }
-
-                          thread_minmer_indexes[t].push_back(mi);
-                          index_progress.increment(1);
                       }
-                      delete threadOutputs[i];
+                      std::vector<const MinmerInfo*>().swap(chunk_shards[t][s]);
                   }
-              });
-          }
-
-          for (auto& thread : index_threads) {
-              thread.join();
+              }
+          });
+          decltype(chunk_shards)().swap(chunk_shards);
+
+          // Shards get consecutive ranges of the point array
+          std::vector<uint64_t> shard_point_offsets(numShards + 1, 0);
+          uint64_t max_shard_keys = 0;
+          uint64_t total_keys = 0;
+          for (size_t s = 0; s < numShards; ++s) {
+              shard_point_offsets[s + 1] = shard_point_offsets[s] + shard_points[s];
+              max_shard_keys = std::max<uint64_t>(max_shard_keys, shard_pos_lists[s].size());
+              total_keys += shard_pos_lists[s].size();
           }
 
-          // Merge results
-          uint64_t total_kmers = std::accumulate(thread_total_kmers.begin(), thread_total_kmers.end(), 0ULL);
-          uint64_t filtered_kmers = std::accumulate(thread_filtered_kmers.begin(), thread_filtered_kmers.end(), 0ULL);
-
-          // Clear and resize main indexes
-          minmerPosLookupIndex.clear();
-          minmerIndex.clear();
-          
-          // Reserve approximate space
-          size_t total_minmers = 0;
-          for (const auto& thread_index : thread_minmer_indexes) {
-              total_minmers += thread_index.size();
+          minmerPosLookupIndex.allocateShards(shardBits, max_shard_keys, shard_point_offsets[numShards]);
+          next_shard = 0;
+          runThreads(numThreads, [&](size_t) {
+              for (size_t s = next_shard++; s < numShards; s = next_shard++) {
+                  minmerPosLookupIndex.fillShard(shard_pos_lists[s], shard_point_offsets[s]);
+                  MI_Map_t().swap(shard_pos_lists[s]);
+              }
+          });
+          minmerPosLookupIndex.finishShards(total_keys);
+
+          seedFilter.allocate(total_keys);
+          runThreads(numThreads, [&](size_t t) {
+              const PosListIndex::Slot* slots = minmerPosLookupIndex.slotArray();
+              uint64_t numSlots = minmerPosLookupIndex.slotArraySize();
+              uint64_t start = numSlots * t / numThreads;
+              uint64_t end = numSlots * (t + 1) / numThreads;
+              for (uint64_t i = start; i < end; ++i) {
+                  if (slots[i].count != 0) {
+                      seedFilter.insert(slots[i].hash);
+                  }
+              }
+          });
+
+          // Copy the windows of infrequent hashes, each chunk to its own range
+          auto isFrequent = [&](hash_t hash) {
+              const HF_Set_t& frequent = shard_frequent[PosListIndex::shardOf(hash, shardBits)];
+              return !frequent.empty() && frequent.count(hash) != 0;
+          };
+          std::vector<uint64_t> chunk_kept(numThreads + 1, 0);
+          runThreads(numThreads, [&](size_t t) {
+              size_t start = std::min(t * chunk_size, threadOutputs.size());
+              size_t end = std::min(start + chunk_size, threadOutputs.size());
+              for (size_t i = start; i < end; ++i) {
+                  for (const MinmerInfo& mi : *threadOutputs[i]) {
+                      chunk_kept[t + 1] += !isFrequent(mi.hash);
+                  }
+              }
+          });
+          for (size_t t = 0; t < numThreads; ++t) {
+              chunk_kept[t + 1] += chunk_kept[t];
           }
-          minmerIndex.reserve(total_minmers);
 
-          // Merge position lookup indexes
-          for (auto& thread_pos_index : thread_pos_indexes) {
-              for (auto& [hash, pos_list] : thread_pos_index) {
-                  auto& main_pos_list = minmerPosLookupIndex[hash];
-                  main_pos_list.insert(main_pos_list.end(), pos_list.begin(), pos_list.end());
+          minmerStore.clear();
+          minmerStore.resize(chunk_kept[numThreads]);
+          runThreads(numThreads, [&](size_t t) {
+              size_t start = std::min(t * chunk_size, threadOutputs.size());
+              size_t end = std::min(start + chunk_size, threadOutputs.size());
+              MinmerInfo* out = minmerStore.data() + chunk_kept[t];
+              for (size_t i = start; i < end; ++i) {
+                  uint64_t kept = 0;
+                  for (const MinmerInfo& mi : *threadOutputs[i]) {
+                      if (!isFrequent(mi.hash)) {
+                          *out++ = mi;
+                          kept++;
+                      }
+                  }
+                  index_progress.increment(kept);
+                  delete threadOutputs[i];
               }
+          });
+          useMinmerStore();
+          if (param.compactWindows) {
+              convertToWindowColumns();
           }
 
-          // Merge minmer indexes
-          for (auto& thread_index : thread_minmer_indexes) {
-              minmerIndex.insert(minmerIndex.end(), 
-                               std::make_move_iterator(thread_index.begin()),
-                               std::make_move_iterator(thread_index.end()));
+          uint64_t total_kmers = total_windows;
+          uint64_t filtered_kmers = total_windows - minmerStore.size();
+          uint64_t filtered_hashes = 0;
+          for (const auto& frequent : shard_frequent) {
+              filtered_hashes += frequent.size();
           }
-          
+          if (countSketch && param.verbose) {
+              std::cerr << "[wfmash::mashmap] Count-min sketch (" << std::fixed << std::setprecision(1)
+                        << countSketch->bytes() / (1024.0 * 1024.0) << " MiB): "
+                        << std::accumulate(shard_counted.begin(), shard_counted.end(), 0ULL)
+                        << " hashes above the threshold counted exactly" << std::endl;
+          }
+
           // Finish second progress meter
           index_progress.finish();
 
@@ -366,9 +520,18 @@ namespace skch
               freq_cutoff = (uint64_t)param.max_kmer_freq;
           }
           std::cerr << "[wfmash::mashmap] Processed " << totalSeqProcessed << " sequences (" << totalSeqSkipped << " skipped, " << total_seq_length << " total bp), " 
-                    << minmerPosLookupIndex.size() << " unique hashes, " << minmerIndex.size() << " windows" << std::endl
-                    << "[wfmash::mashmap] Filtered " << filtered_kmers << "/" << total_kmers 
-                    << " k-mers occurring > " << freq_cutoff << " times"
+                    << minmerPosLookupIndex.size() << " unique hashes, " << windowCount() << " windows" << std::endl;
+          if (param.verbose) {
+              std::cerr << "[wfmash::mashmap] Windows: " << (useWindowColumns ? "columns" : "records") << " in "
+                        << std::fixed << std::setprecision(1) << windowBytes() / (1024.0 * 1024.0) << " MiB ("
+                        << std::setprecision(1) << (windowCount() ? double(windowBytes()) / windowCount() : 0.0)
+                        << " bytes per window)" << std::endl;
+              std::cerr << "[wfmash::mashmap] Position lookup: " << minmerPosLookupIndex.pointCount() << " interval points in "
+                        << std::fixed << std::setprecision(1) << minmerPosLookupIndex.bytes() / (1024.0 * 1024.0) << " MiB"
+                        << " and a " << seedFilter.bytes() / (1024.0 * 1024.0) << " MiB seed filter" << std::endl;
+          }
+          std::cerr << "[wfmash::mashmap] Filtered " << filtered_kmers << "/" << total_kmers 
+                    << " k-mers (" << filtered_hashes << " distinct hashes) occurring > " << freq_cutoff << " times"
                     << " (target: " << (param.max_kmer_freq <= 1.0 ? 
                                       ([&]() { 
                                           std::stringstream ss;
@@ -382,7 +545,7 @@ namespace skch
         std::chrono::duration<double> timeRefSketch = skch::Time::now() - t0;
         std::cerr << "[wfmash::mashmap] reference index computed in " << timeRefSketch.count() << "s" << std::endl;
 
-        if (this->minmerIndex.size() == 0)
+        if (windowCount() == 0)
         {
           std::cerr << "[wfmash::mashmap] ERROR, reference sketch is empty. "
                     << "Reference sequences shorter than the kmer size are not indexed" << std::endl;
@@ -410,6 +573,7 @@ namespace skch
                 param.kmerSize, 
                 param.segLength, 
                 param.alphabetSize, 
+                param.kmerHash,
                 param.sketchSize,
                 input->seqId,
                 progress);
@@ -417,56 +581,6 @@ namespace skch
         return thread_output;
       }
 
-      /**
-       * @brief                 routine to handle thread's local minmer index
-       * @param[in] output      thread local minmer output
-       */
-
-      void buildHandleThreadOutput(MI_Type* contigMinmerIndex)
-      {
-          // Count k-mer frequencies first
-          HF_Map_t kmer_freqs;
-          for (const auto& mi : *contigMinmerIndex) {
-              kmer_freqs[mi.hash]++;
-          }
-
-          // This function is kept for compatibility but should not be used
-          // when parallel index building is enabled
-          for (MinmerInfo& mi : *contigMinmerIndex) {
-              // Skip high-frequency k-mers
-              auto freq_it = kmer_freqs.find(mi.hash);
-              if (freq_it != kmer_freqs.end() && freq_it->second > param.max_kmer_freq) {
-                  continue;
-              }
-
-              if (minmerPosLookupIndex[mi.hash].size() == 0 
-                      || minmerPosLookupIndex[mi.hash].back().hash != mi.hash 
-                      || minmerPosLookupIndex[mi.hash].back().pos != mi.wpos) {
-                  minmerPosLookupIndex[mi.hash].push_back(IntervalPoint {mi.wpos, mi.hash, mi.seqId, side::OPEN});
-                  minmerPosLookupIndex[mi.hash].push_back(IntervalPoint {mi.wpos_end, mi.hash, mi.seqId, side::CLOSE});
-              } else {
-                  minmerPosLookupIndex[mi.hash].back().pos = mi.wpos_end;
-              }
-          }
-
-          // Only add k-mers that aren't too frequent
-          MI_Type filtered_minmers;
-          for (const auto& mi : *contigMinmerIndex) {
-              auto freq_it = kmer_freqs.find(mi.hash);
-              if (freq_it == kmer_freqs.end() || freq_it->second <= param.max_kmer_freq) {
-                  filtered_minmers.push_back(mi);
-              }
-          }
-
-          this->minmerIndex.insert(
-              this->minmerIndex.end(), 
-              std::make_move_iterator(filtered_minmers.begin()), 
-              std::make_move_iterator(filtered_minmers.end()));
-
-          delete contigMinmerIndex;
-      }
-
-
       /**
        * @brief  Write sketch as tsv. TSV indexing is slower but can be debugged easier
        */
@@ -483,34 +597,62 @@ namespace skch
 
 
       /**
-       * @brief  Write sketch for quick loading
+       * @brief  Pad the stream with zeros up to the next section boundary
        */
-      void writeSketchBinary(std::ofstream& outStream) 
+      void writeSectionPadding(std::ofstream& outStream)
       {
-        typename MI_Type::size_type size = minmerIndex.size();
-        outStream.write((char*)&size, sizeof(size));
-        outStream.write((char*)&minmerIndex[0], minmerIndex.size() * sizeof(MinmerInfo));
+        static const char zeros[INDEX_SECTION_ALIGN] = {};
+        uint64_t pos = outStream.tellp();
+        outStream.write(zeros, (INDEX_SECTION_ALIGN - pos % INDEX_SECTION_ALIGN) % INDEX_SECTION_ALIGN);
       }
 
       /**
-       * @brief  Write posList for quick loading
+       * @brief  Write the minmer windows and the position lookup as aligned flat
+       *         sections, preceded by their sizes, so that they can be mapped in place
        */
-      void writePosListBinary(std::ofstream& outStream) 
+      void writeSections(std::ofstream& outStream)
       {
-        typename MI_Map_t::size_type size = minmerPosLookupIndex.size();
-        outStream.write((char*)&size, sizeof(size));
-
-        for (auto& [hash, ipVec] : minmerPosLookupIndex) 
-        {
-          MinmerMapKeyType key = hash;
-          outStream.write((char*)&key, sizeof(key));
-          typename MI_Type::size_type size = ipVec.size();
-          outStream.write((char*)&size, sizeof(size));
-          outStream.write((char*)&ipVec[0], ipVec.size() * sizeof(MinmerMapValueType::value_type));
+        const uint64_t sizes[INDEX_SECTION_SIZES] = {
+          windowCount(),
+          minmerPosLookupIndex.slotArraySize(),
+          minmerPosLookupIndex.pointCount(),
+          minmerPosLookupIndex.size(),
+          minmerPosLookupIndex.shardCountBits(),
+          windowOffsets.seqArraySize(),
+          windowOffsets.bucketArraySize(),
+          uint64_t(windowOffsets.firstSequence()),
+          windowOffsets.positionBucketBits(),
+          useWindowColumns ? 1ULL : 0ULL,
+          seedFilter.wordCount()};
+        outStream.write((char*)sizes, sizeof(sizes));
+
+        writeSectionPadding(outStream);
+        outStream.write((char*)minmerIndex.begin(), minmerIndex.size() * sizeof(MinmerInfo));
+        writeSectionPadding(outStream);
+        outStream.write((char*)minmerPosLookupIndex.slotArray(), sizes[1] * sizeof(PosListIndex::Slot));
+        writeSectionPadding(outStream);
+        outStream.write((char*)minmerPosLookupIndex.pointArray(), sizes[2] * sizeof(PackedIntervalPoint));
+        writeSectionPadding(outStream);
+        outStream.write((char*)windowOffsets.seqArray(), sizes[5] * sizeof(WindowOffsetIndex::SeqEntry));
+        writeSectionPadding(outStream);
+        outStream.write((char*)windowOffsets.bucketArray(), sizes[6] * sizeof(uint64_t));
+        writeSectionPadding(outStream);
+        if (useWindowColumns) {
+          outStream.write((char*)windowColumns.baseArray(), windowColumns.baseArraySize() * sizeof(offset_t));
+          writeSectionPadding(outStream);
+          outStream.write((char*)windowColumns.hashArray(), sizes[0] * sizeof(hash_t));
+          writeSectionPadding(outStream);
+          outStream.write((char*)windowColumns.startArray(), sizes[0] * sizeof(uint32_t));
+          writeSectionPadding(outStream);
+          outStream.write((char*)windowColumns.lengthArray(), sizes[0] * sizeof(uint32_t));
+          writeSectionPadding(outStream);
+          outStream.write((char*)windowColumns.strandArray(), sizes[0] * sizeof(int8_t));
+          writeSectionPadding(outStream);
         }
+        outStream.write((char*)seedFilter.wordArray(), sizes[10] * sizeof(uint64_t));
+        writeSectionPadding(outStream);
       }
 
-
       /**
        * @brief  Write posList for quick loading
        */
@@ -526,18 +668,35 @@ namespace skch
         outStream.write((char*) &param.segLength, sizeof(param.segLength));
         outStream.write((char*) &param.sketchSize, sizeof(param.sketchSize));
         outStream.write((char*) &param.kmerSize, sizeof(param.kmerSize));
+        outStream.write((char*) &param.kmerHash, sizeof(param.kmerHash));
       }
 
 
       /**
        * @brief  Write all index data structures to disk
+       * @details When appending, the new sub-index replaces the directory of the
+       *          file, which is then written again with an entry for it
        */
       void writeIndex(const std::vector<std::string>& target_subset, const std::string& filename = "", bool append = false) 
       {
         fs::path indexFilename = filename.empty() ? fs::path(param.indexFilename) : fs::path(filename);
+        IndexDirectory directory;
+        uint64_t subIndexOffset = 0;
+        bool withDirectory = true;
+        if (append) {
+            // Files without a directory were not written by this version; keep them that way
+            withDirectory = directory.read(indexFilename.string(), subIndexOffset);
+            if (withDirectory) {
+                fs::resize_file(indexFilename, subIndexOffset);
+            } else {
+                subIndexOffset = fs::file_size(indexFilename);
+            }
+        }
         std::ofstream outStream;
         if (append) {
-            outStream.open(indexFilename, std::ios::binary | std::ios::app);
+            // Not std::ios::app, section padding needs the absolute file offset
+            outStream.open(indexFilename, std::ios::binary | std::ios::in | std::ios::out);
+            outStream.seekp(subIndexOffset);
         } else {
             outStream.open(indexFilename, std::ios::binary);
         }
@@ -547,16 +706,27 @@ namespace skch
         }
         writeSubIndexHeader(outStream, target_subset);
         writeParameters(outStream);
-        writeSketchBinary(outStream);
-        writePosListBinary(outStream);
+        writeSections(outStream);
         // Removed writeFreqKmersBinary call
+        if (withDirectory) {
+            uint64_t subIndexSize = uint64_t(outStream.tellp()) - subIndexOffset;
+            directory.entries.push_back(IndexDirectory::Entry{subIndexOffset, subIndexSize,
+                param.segLength, param.sketchSize, param.kmerSize, param.kmerHash, target_subset});
+            directory.write(outStream);
+        }
         outStream.close();
+        if (!outStream) {
+            std::cerr << "Error: Failed to write index file: " << indexFilename << std::endl;
+            exit(1);
+        }
       }
 
       void writeSubIndexHeader(std::ofstream& outStream, const std::vector<std::string>& target_subset) 
       {
-        const uint64_t magic_number = 0xDEADBEEFCAFEBABE;
+        const uint64_t magic_number = INDEX_MAGIC;
         outStream.write(reinterpret_cast<const char*>(&magic_number), sizeof(magic_number));
+        const uint32_t version = INDEX_VERSION;
+        outStream.write(reinterpret_cast<const char*>(&version), sizeof(version));
         uint64_t num_sequences = target_subset.size();
         outStream.write(reinterpret_cast<const char*>(&num_sequences), sizeof(num_sequences));
         for (const auto& seqName : target_subset) {
@@ -579,8 +749,9 @@ namespace skch
         seqno_t seqId;
         while (inReader.read_row(seqId, strand, start, end, hash))
         {
-          this->minmerIndex.push_back(MinmerInfo {hash, start, end, seqId, strand});
+          this->minmerStore.push_back(MinmerInfo {hash, start, end, seqId, strand});
         }
+        useMinmerStore();
       }
 
       /**
@@ -590,8 +761,9 @@ namespace skch
       {
         typename MI_Type::size_type size = 0;
         inStream.read((char*)&size, sizeof(size));
-        minmerIndex.resize(size);
-        inStream.read((char*)&minmerIndex[0], minmerIndex.size() * sizeof(MinmerInfo));
+        minmerStore.resize(size);
+        inStream.read((char*)&minmerStore[0], minmerStore.size() * sizeof(MinmerInfo));
+        useMinmerStore();
       }
 
       /**
@@ -601,8 +773,10 @@ namespace skch
       {
         typename MI_Map_t::size_type numKeys = 0;
         inStream.read((char*)&numKeys, sizeof(numKeys));
-        minmerPosLookupIndex.reserve(numKeys);
+        minmerPosLookupIndex.clear();
+        seedFilter.clear();
 
+        MinmerMapValueType ipVec;
         for (auto idx = 0; idx < numKeys; idx++) 
         {
           MinmerMapKeyType key = 0;
@@ -610,8 +784,9 @@ namespace skch
           typename MinmerMapValueType::size_type size = 0;
           inStream.read((char*)&size, sizeof(size));
 
-          minmerPosLookupIndex[key].resize(size);
-          inStream.read((char*)&minmerPosLookupIndex[key][0], size * sizeof(MinmerMapValueType::value_type));
+          ipVec.resize(size);
+          inStream.read((char*)&ipVec[0], size * sizeof(MinmerMapValueType::value_type));
+          minmerPosLookupIndex.insert(key, ipVec.data(), ipVec.data() + ipVec.size());
         }
       }
 
@@ -629,6 +804,11 @@ namespace skch
         inStream.read((char*) &index_sketchSize, sizeof(index_sketchSize));
         inStream.read((char*) &index_kmerSize, sizeof(index_kmerSize));
 
+        // Indexes without a version field were sketched with Murmur
+        KmerHash index_kmerHash = KmerHash::MURMUR3;
+        if (!unversionedIndex)
+          inStream.read((char*) &index_kmerHash, sizeof(index_kmerHash));
+
         if (param.segLength != index_segLength 
             || param.sketchSize != index_sketchSize
             || param.kmerSize != index_kmerSize)
@@ -640,6 +820,15 @@ namespace skch
                     << " sketchSize=" << param.sketchSize << " kmerSize=" << param.kmerSize << std::endl;
           exit(1);
         }
+
+        // The index decides how k-mers are hashed; queries must be sketched the same way
+        if (index_kmerHash != KmerHash::MURMUR3 && index_kmerHash != KmerHash::ROLLING_2BIT)
+        {
+          std::cerr << "[wfmash::mashmap] ERROR: unknown k-mer hash " << static_cast<uint32_t>(index_kmerHash)
+                    << " in index" << std::endl;
+          exit(1);
+        }
+        param.kmerHash = index_kmerHash;
       }
 
 
@@ -654,16 +843,97 @@ namespace skch
             exit(1);
         }
         readParameters(inStream);
-        readSketchBinary(inStream);
-        readPosListBinary(inStream);
+        if (unversionedIndex) {
+          readSketchBinary(inStream);
+          readPosListBinary(inStream);
+        } else {
+          mapSections(inStream);
+        }
         // Removed readFreqKmersBinary call
       }
 
+      /**
+       * @brief  Point the minmer windows and the position lookup at the sections
+       *         of a versioned sub-index in the mapped index file, and skip them
+       */
+      void mapSections(std::ifstream& inStream)
+      {
+        uint64_t sizes[INDEX_SECTION_SIZES] = {};
+        inStream.read((char*)sizes, INDEX_SECTION_SIZES * sizeof(uint64_t));
+        uint64_t regionSize = sizes[4] < 64 ? sizes[1] >> sizes[4] : 0;
+        if (!inStream || (regionSize << sizes[4]) != sizes[1] || (regionSize & (regionSize - 1)) != 0
+            || sizes[8] >= 63 || sizes[9] > 1 || sizes[10] % SeedFilter::BLOCK_WORDS != 0
+            || (sizes[10] & (sizes[10] - 1)) != 0) {
+          std::cerr << "[wfmash::mashmap] Error: index file is truncated or corrupt" << std::endl;
+          exit(1);
+        }
+
+        auto align = [](uint64_t offset) {
+          return (offset + INDEX_SECTION_ALIGN - 1) / INDEX_SECTION_ALIGN * INDEX_SECTION_ALIGN;
+        };
+        bool columns = sizes[9] == 1;
+        uint64_t numRecords = columns ? 0 : sizes[0];
+        uint64_t numColumnEntries = columns ? sizes[0] : 0;
+        uint64_t numBases = columns ? sizes[5] : 0;
+        uint64_t minmerOffset = align(inStream.tellg());
+        uint64_t slotOffset = align(minmerOffset + numRecords * sizeof(MinmerInfo));
+        uint64_t pointOffset = align(slotOffset + sizes[1] * sizeof(PosListIndex::Slot));
+        uint64_t seqOffset = align(pointOffset + sizes[2] * sizeof(PackedIntervalPoint));
+        uint64_t bucketOffset = align(seqOffset + sizes[5] * sizeof(WindowOffsetIndex::SeqEntry));
+        uint64_t baseOffset = align(bucketOffset + sizes[6] * sizeof(uint64_t));
+        uint64_t hashOffset = align(baseOffset + numBases * sizeof(offset_t));
+        uint64_t startOffset = align(hashOffset + numColumnEntries * sizeof(hash_t));
+        uint64_t lengthOffset = align(startOffset + numColumnEntries * sizeof(uint32_t));
+        uint64_t strandOffset = align(lengthOffset + numColumnEntries * sizeof(uint32_t));
+        uint64_t filterOffset = align(strandOffset + numColumnEntries * sizeof(int8_t));
+        uint64_t endOffset = align(filterOffset + sizes[10] * sizeof(uint64_t));
+
+        indexMapping = std::make_unique<MappedFile>(param.indexFilename.string());
+        const MinmerInfo* minmers = indexMapping->at<MinmerInfo>(minmerOffset, numRecords);
+        minmerIndex = MinmerView{minmers, minmers + numRecords};
+        useWindowColumns = columns;
+        if (columns) {
+          windowColumns.attach(
+              indexMapping->at<offset_t>(baseOffset, numBases), numBases,
+              indexMapping->at<hash_t>(hashOffset, numColumnEntries),
+              indexMapping->at<uint32_t>(startOffset, numColumnEntries),
+              indexMapping->at<uint32_t>(lengthOffset, numColumnEntries),
+              indexMapping->at<int8_t>(strandOffset, numColumnEntries), numColumnEntries);
+        }
+        windowOffsets.attach(
+            indexMapping->at<WindowOffsetIndex::SeqEntry>(seqOffset, sizes[5]), sizes[5],
+            indexMapping->at<uint64_t>(bucketOffset, sizes[6]), sizes[6],
+            seqno_t(sizes[7]), uint32_t(sizes[8]));
+        minmerPosLookupIndex.attach(
+            indexMapping->at<PosListIndex::Slot>(slotOffset, sizes[1]), sizes[1],
+            indexMapping->at<PackedIntervalPoint>(pointOffset, sizes[2]), sizes[2],
+            sizes[3], uint32_t(sizes[4]));
+        seedFilter.attach(indexMapping->at<uint64_t>(filterOffset, sizes[10]), sizes[10]);
+        inStream.seekg(endOffset);
+
+        std::cerr << "[wfmash::mashmap] Mapped " << windowCount() << " windows ("
+                  << (useWindowColumns ? "columns" : "records") << ") and "
+                  << minmerPosLookupIndex.size() << " hashes ("
+                  << std::fixed << std::setprecision(1) << (endOffset - minmerOffset) / (1024.0 * 1024.0)
+                  << " MiB) from the index file" << std::endl;
+      }
+
       bool readSubIndexHeader(std::ifstream& inStream, const std::vector<std::string>& targetSequenceNames) 
       {
         uint64_t magic_number = 0;
         inStream.read(reinterpret_cast<char*>(&magic_number), sizeof(magic_number));
-        if (magic_number != 0xDEADBEEFCAFEBABE) {
+        if (magic_number == INDEX_MAGIC) {
+            uint32_t version = 0;
+            inStream.read(reinterpret_cast<char*>(&version), sizeof(version));
+            if (version != INDEX_VERSION) {
+                std::cerr << "Error: Index file version " << version
+                          << " is not supported, rebuild the index." << std::endl;
+                exit(1);
+            }
+            unversionedIndex = false;
+        } else if (magic_number == INDEX_MAGIC_UNVERSIONED) {
+            unversionedIndex = true;
+        } else {
             std::cerr << "Error: Invalid magic number in index file." << std::endl;
             exit(1);
         }
@@ -702,10 +972,55 @@ namespace skch
         return this->minmerIndex.end();
       }
 
+      /**
+       * @brief     Number of reference windows
+       */
+      uint64_t windowCount() const
+      {
+        return useWindowColumns ? windowColumns.size() : minmerIndex.size();
+      }
+
+      /**
+       * @brief     call f(windows, begin, end) on the windows of a sequence, from
+       *            the first one starting at or after pos to the last one
+       * @details   windows is a WindowRecords or WindowColumnSlice accessor,
+       *            indexed by position in the window array
+       */
+      template <typename F>
+        void forSequenceWindows(seqno_t seqId, offset_t pos, F f) const
+        {
+          if (useWindowColumns) {
+            int64_t s = windowOffsets.seqIndex(seqId);
+            if (s < 0)
+              return;
+            WindowColumnSlice windows = windowColumns.slice(s);
+            auto range = windowOffsets.find(windows, seqId, pos);
+            f(windows, range.first, range.second);
+          } else {
+            WindowRecords windows{minmerIndex.begin()};
+            auto range = windowOffsets.find(windows, seqId, pos);
+            f(windows, range.first, range.second);
+          }
+        }
+
+      /**
+       * @brief     k-mer hash the sketch was built with
+       */
+      KmerHash getKmerHash() const
+      {
+        return param.kmerHash;
+      }
+
       void clear()
       {
         minmerPosLookupIndex.clear();
-        minmerIndex.clear();
+        seedFilter.clear();
+        minmerIndex = MinmerView{};
+        windowOffsets.clear();
+        windowColumns.clear();
+        useWindowColumns = false;
+        minmerStore.clear();
+        indexMapping.reset();
         minmerFreqHistogram.clear();
       }
 
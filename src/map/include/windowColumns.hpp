@@ -0,0 +1,212 @@
+/**
+ * @file    windowColumns.hpp
+ * @brief   compact column layout of the reference minmer windows, and the
+ *          accessors the L2 sweep reads windows through
+ */
+
+#ifndef SKETCH_WINDOW_COLUMNS_HPP
+#define SKETCH_WINDOW_COLUMNS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+#include "map/include/windowOffsetIndex.hpp"
+
+namespace skch
+{
+  /**
+   * @brief   windows of one sequence in MinmerInfo records
+   */
+  struct WindowRecords
+  {
+    const MinmerInfo* windows;
+
+    hash_t hash(uint64_t i) const { return windows[i].hash; }
+    offset_t wpos(uint64_t i) const { return windows[i].wpos; }
+    offset_t wposEnd(uint64_t i) const { return windows[i].wpos_end; }
+    strand_t strand(uint64_t i) const { return windows[i].strand; }
+
+    uint64_t lowerBound(uint64_t lo, uint64_t hi, offset_t pos) const
+    {
+      return std::lower_bound(windows + lo, windows + hi, pos,
+          [](const MinmerInfo& mi, offset_t p) { return mi.wpos < p; }) - windows;
+    }
+  };
+
+  /**
+   * @brief   windows of one sequence in WindowColumns
+   */
+  struct WindowColumnSlice
+  {
+    const hash_t* hashes;
+    const uint32_t* starts;
+    const uint32_t* lengths;
+    const int8_t* strands;
+    offset_t base;
+
+    hash_t hash(uint64_t i) const { return hashes[i]; }
+    offset_t wpos(uint64_t i) const { return base + starts[i]; }
+    offset_t wposEnd(uint64_t i) const { return base + starts[i] + lengths[i]; }
+    strand_t strand(uint64_t i) const { return strands[i]; }
+
+    uint64_t lowerBound(uint64_t lo, uint64_t hi, offset_t pos) const
+    {
+      if (pos <= base)
+        return lo;
+      if (pos - base > offset_t(std::numeric_limits<uint32_t>::max()))
+        return hi;
+      return std::lower_bound(starts + lo, starts + hi, uint32_t(pos - base)) - starts;
+    }
+  };
+
+  /**
+   * @class     skch::WindowColumns
+   * @brief     reference windows as separate hash, start, length and strand
+   *            arrays (17 bytes per window instead of 32)
+   * @details   Starts are 32-bit offsets from a base position per sequence,
+   *            the first window start of the sequence; window ends are stored
+   *            as lengths. Sequence ids are implied by the WindowOffsetIndex
+   *            ranges. Like the other index tables, the arrays can be attached
+   *            from a mapped index file.
+   */
+  class WindowColumns
+  {
+    private:
+
+      std::vector<offset_t> bases;
+      std::vector<hash_t> hashes;
+      std::vector<uint32_t> starts;
+      std::vector<uint32_t> lengths;
+      std::vector<int8_t> strands;
+
+      const offset_t* baseData = nullptr;
+      const hash_t* hashData = nullptr;
+      const uint32_t* startData = nullptr;
+      const uint32_t* lengthData = nullptr;
+      const int8_t* strandData = nullptr;
+      uint64_t windowCount = 0;
+      uint64_t baseCount = 0;
+
+      void syncViews()
+      {
+        baseData = bases.data();
+        hashData = hashes.data();
+        startData = starts.data();
+        lengthData = lengths.data();
+        strandData = strands.data();
+        windowCount = hashes.size();
+        baseCount = bases.size();
+      }
+
+    public:
+
+      /**
+       * @brief     convert windows sorted by (seqId, wpos), with their offset index
+       * @return    false, leaving the columns empty, if a sequence spans more
+       *            than 2^32 positions
+       */
+      bool build(const MinmerInfo* first, const MinmerInfo* last, const WindowOffsetIndex& offsets)
+      {
+        clear();
+        const auto* seqs = offsets.seqArray();
+        uint64_t numSeqs = offsets.seqArraySize();
+        uint64_t n = last - first;
+
+        bases.assign(numSeqs, 0);
+        for (uint64_t s = 0; s + 1 < numSeqs; s++)
+        {
+          uint64_t lo = seqs[s].firstWindow, hi = seqs[s + 1].firstWindow;
+          if (lo == hi)
+            continue;
+          bases[s] = first[lo].wpos;
+          for (uint64_t i = lo; i < hi; i++)
+          {
+            offset_t start = first[i].wpos - bases[s];
+            offset_t length = first[i].wpos_end - first[i].wpos;
+            if (start > offset_t(std::numeric_limits<uint32_t>::max())
+                || length < 0 || length > offset_t(std::numeric_limits<uint32_t>::max()))
+            {
+              clear();
+              return false;
+            }
+          }
+        }
+
+        hashes.resize(n);
+        starts.resize(n);
+        lengths.resize(n);
+        strands.resize(n);
+        for (uint64_t s = 0; s + 1 < numSeqs; s++)
+        {
+          for (uint64_t i = seqs[s].firstWindow; i < seqs[s + 1].firstWindow; i++)
+          {
+            hashes[i] = first[i].hash;
+            starts[i] = uint32_t(first[i].wpos - bases[s]);
+            lengths[i] = uint32_t(first[i].wpos_end - first[i].wpos);
+            strands[i] = int8_t(first[i].strand);
+          }
+        }
+        syncViews();
+        return true;
+      }
+
+      /**
+       * @brief     use arrays written by the array accessors in place
+       */
+      void attach(const offset_t* baseArray, uint64_t numBases, const hash_t* hashArray,
+          const uint32_t* startArray, const uint32_t* lengthArray, const int8_t* strandArray, uint64_t numWindows)
+      {
+        clear();
+        baseData = baseArray;
+        baseCount = numBases;
+        hashData = hashArray;
+        startData = startArray;
+        lengthData = lengthArray;
+        strandData = strandArray;
+        windowCount = numWindows;
+      }
+
+      /**
+       * @brief     windows of the sequence at position seqIndex of the offset index
+       */
+      WindowColumnSlice slice(uint64_t seqIndex) const
+      {
+        return WindowColumnSlice{hashData, startData, lengthData, strandData,
+          seqIndex < baseCount ? baseData[seqIndex] : 0};
+      }
+
+      //Raw arrays, for writing the index
+      const offset_t* baseArray() const { return baseData; }
+      uint64_t baseArraySize() const { return baseCount; }
+      const hash_t* hashArray() const { return hashData; }
+      const uint32_t* startArray() const { return startData; }
+      const uint32_t* lengthArray() const { return lengthData; }
+      const int8_t* strandArray() const { return strandData; }
+
+      //Number of windows
+      uint64_t size() const { return windowCount; }
+      bool empty() const { return windowCount == 0; }
+
+      uint64_t bytes() const
+      {
+        return baseCount * sizeof(offset_t)
+          + windowCount * (sizeof(hash_t) + 2 * sizeof(uint32_t) + sizeof(int8_t));
+      }
+
+      void clear()
+      {
+        std::vector<offset_t>().swap(bases);
+        std::vector<hash_t>().swap(hashes);
+        std::vector<uint32_t>().swap(starts);
+        std::vector<uint32_t>().swap(lengths);
+        std::vector<int8_t>().swap(strands);
+        syncViews();
+      }
+  };
+}
+
+#endif
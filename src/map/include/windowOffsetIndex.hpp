@@ -0,0 +1,172 @@
+/**
+ * @file    windowOffsetIndex.hpp
+ * @brief   per-sequence ranges of the minmer window array, with coarse
+ *          position buckets
+ */
+
+#ifndef SKETCH_WINDOW_OFFSET_INDEX_HPP
+#define SKETCH_WINDOW_OFFSET_INDEX_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+
+namespace skch
+{
+  /**
+   * @class     skch::WindowOffsetIndex
+   * @brief     locates the windows of a sequence near a position without
+   *            searching the whole window array
+   * @details   The windows are sorted by (seqId, wpos). For every sequence id
+   *            between the first and last indexed one, an entry gives its first
+   *            window and its first position bucket; bucket b of a sequence
+   *            holds the index of its first window with wpos >= b << bucketBits.
+   *            A lookup then only searches the windows of one bucket. Like
+   *            PosListIndex, the arrays hold no pointers and can be attached
+   *            from a mapped index file.
+   */
+  class WindowOffsetIndex
+  {
+    public:
+
+      struct SeqEntry
+      {
+        uint64_t firstWindow;
+        uint64_t firstBucket;
+      };
+
+    private:
+
+      //Storage owned when built, empty if attached
+      std::vector<SeqEntry> seqs;
+      std::vector<uint64_t> buckets;
+
+      //Arrays used for lookups
+      const SeqEntry* seqData = nullptr;
+      uint64_t seqCount = 0;                //entries, one more than the sequences
+      const uint64_t* bucketData = nullptr;
+      uint64_t bucketCount = 0;
+      seqno_t firstSeqId = 0;
+      uint32_t bucketBits = 0;
+
+      void syncViews()
+      {
+        seqData = seqs.data();
+        seqCount = seqs.size();
+        bucketData = buckets.data();
+        bucketCount = buckets.size();
+      }
+
+    public:
+
+      /**
+       * @brief     build for windows sorted by (seqId, wpos)
+       */
+      void build(const MinmerInfo* first, const MinmerInfo* last, uint32_t bits)
+      {
+        clear();
+        bucketBits = bits;
+        if (first == last)
+          return;
+
+        firstSeqId = first->seqId;
+        seqno_t lastSeqId = (last - 1)->seqId;
+        seqs.reserve(lastSeqId - firstSeqId + 2);
+
+        const MinmerInfo* it = first;
+        for (seqno_t seqId = firstSeqId; seqId <= lastSeqId; seqId++)
+        {
+          seqs.push_back(SeqEntry{uint64_t(it - first), buckets.size()});
+          const MinmerInfo* seqEnd = it;
+          while (seqEnd != last && seqEnd->seqId == seqId)
+            seqEnd++;
+          if (seqEnd == it)
+            continue;
+
+          offset_t lastBucket = std::max<offset_t>(0, (seqEnd - 1)->wpos) >> bucketBits;
+          for (offset_t b = 0; b <= lastBucket; b++)
+          {
+            while (b > 0 && it != seqEnd && it->wpos < (b << bucketBits))
+              it++;
+            buckets.push_back(uint64_t(it - first));
+          }
+          it = seqEnd;
+        }
+        seqs.push_back(SeqEntry{uint64_t(last - first), buckets.size()});
+        syncViews();
+      }
+
+      /**
+       * @brief     use arrays written by seqArray()/bucketArray() in place
+       */
+      void attach(const SeqEntry* seqArray, uint64_t seqArraySize,
+          const uint64_t* bucketArray, uint64_t bucketArraySize, seqno_t firstSeq, uint32_t bits)
+      {
+        clear();
+        seqData = seqArray;
+        seqCount = seqArraySize;
+        bucketData = bucketArray;
+        bucketCount = bucketArraySize;
+        firstSeqId = firstSeq;
+        bucketBits = bits;
+      }
+
+      /**
+       * @brief     position of seqId in the sequence table, or -1 if it has no windows
+       */
+      inline int64_t seqIndex(seqno_t seqId) const
+      {
+        if (seqCount == 0 || seqId < firstSeqId || uint64_t(seqId - firstSeqId) + 1 >= seqCount)
+          return -1;
+        return seqId - firstSeqId;
+      }
+
+      /**
+       * @brief     windows of seqId from the first one with wpos >= pos to the
+       *            last one, as indexes into the window array
+       * @param[in] windows   accessor of the window array, with lowerBound(lo, hi, pos)
+       */
+      template <typename Windows>
+        inline std::pair<uint64_t, uint64_t> find(const Windows& windows, seqno_t seqId, offset_t pos) const
+        {
+          int64_t s = seqIndex(seqId);
+          if (s < 0)
+            return {0, 0};
+          const SeqEntry& seq = seqData[s];
+          const SeqEntry& next = seqData[s + 1];
+          uint64_t seqBuckets = next.firstBucket - seq.firstBucket;
+          if (seqBuckets == 0)
+            return {seq.firstWindow, seq.firstWindow};
+
+          //First window with wpos >= pos lies between the starts of pos's bucket and the next
+          offset_t b = std::max<offset_t>(0, pos) >> bucketBits;
+          if (uint64_t(b) >= seqBuckets)
+            return {next.firstWindow, next.firstWindow};
+          uint64_t lo = bucketData[seq.firstBucket + b];
+          uint64_t hi = uint64_t(b) + 1 < seqBuckets ? bucketData[seq.firstBucket + b + 1] : next.firstWindow;
+          return {windows.lowerBound(lo, hi, pos), next.firstWindow};
+        }
+
+      //Raw arrays, for writing the index
+      const SeqEntry* seqArray() const { return seqData; }
+      uint64_t seqArraySize() const { return seqCount; }
+      const uint64_t* bucketArray() const { return bucketData; }
+      uint64_t bucketArraySize() const { return bucketCount; }
+      seqno_t firstSequence() const { return firstSeqId; }
+      uint32_t positionBucketBits() const { return bucketBits; }
+
+      void clear()
+      {
+        std::vector<SeqEntry>().swap(seqs);
+        std::vector<uint64_t>().swap(buckets);
+        firstSeqId = 0;
+        syncViews();
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,219 @@
+/**
+ * @file    filterEquivalence.cpp
+ * @brief   checks that the mapping filters keep, discard and mark as
+ *          overlapped the same mappings with their flat SweepStatus as with a
+ *          std::set sweep status
+ *
+ * Usage: filter-equivalence FASTA [PAF]
+ *
+ * Filters seeded random mappings on the sequences of FASTA (which must be
+ * indexed), then the mappings of PAF, as written by wfmash -m -f, of each
+ * query. The reference filter also runs on the groups of independent sweeps
+ * in parallel, as the mapper does. Exits with 1 on any difference.
+ */
+
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "map/include/base_types.hpp"
+#include "map/include/sequenceIds.hpp"
+#include "map/include/filter.hpp"
+#include "map/include/taskPool.hpp"
+
+using namespace skch;
+
+namespace
+{
+  //Sweep statuses the filters used before SweepStatus
+  typedef std::set<int, Filter::query::Helper> QuerySetStatus;
+  typedef std::set<int, Filter::ref::Helper> RefSetStatus;
+
+  struct FilterSettings
+  {
+    uint16_t secondaryToKeep;
+    bool dropRand;
+    double overlapThreshold;
+  };
+
+  bool sameMappings(MappingResultsVector_t& a, MappingResultsVector_t& b)
+  {
+    if (a.size() != b.size())
+      return false;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+      if (a[i].hash() != b[i].hash() || a[i].discard != b[i].discard || a[i].overlapped != b[i].overlapped)
+        return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief   run the query and reference filters on the mappings of one
+   *          query with both sweep statuses
+   * @return  number of filters that differ from their std::set instantiation
+   */
+  int compareFilters(const MappingResultsVector_t& mappings, const SequenceIdManager& idManager,
+                     const FilterSettings& s, TaskPool& pool, progress_meter::ProgressMeter& progress)
+  {
+    int differences = 0;
+    MappingResultsVector_t a = mappings, b = mappings;
+    Filter::query::filterMappings(a, s.secondaryToKeep, s.dropRand, s.overlapThreshold, progress);
+    Filter::query::filterMappings<QuerySetStatus>(b, s.secondaryToKeep, s.dropRand, s.overlapThreshold, progress);
+    differences += !sameMappings(a, b);
+
+    a = mappings;
+    b = mappings;
+    Filter::ref::filterMappings(a, idManager, s.secondaryToKeep, s.dropRand, s.overlapThreshold);
+    Filter::ref::filterMappings<RefSetStatus>(b, idManager, s.secondaryToKeep, s.dropRand, s.overlapThreshold);
+    differences += !sameMappings(a, b);
+
+    //Every group of independent sweeps as a task of its own
+    a = mappings;
+    Filter::ref::filterMappingsByGroup(a, idManager, s.secondaryToKeep, s.dropRand, s.overlapThreshold,
+        [&pool](const std::vector<size_t>& groupSizes, const std::function<void(size_t, size_t)>& fn) {
+            pool.parallelFor(groupSizes.size(), [&fn](size_t g) { fn(g, g + 1); });
+        });
+    differences += !sameMappings(a, b);
+    return differences;
+  }
+
+  MappingResultsVector_t randomMappings(std::mt19937_64& rng, const SequenceIdManager& idManager)
+  {
+    MappingResultsVector_t mappings(1 + rng() % 300);
+    offset_t span = 1 + rng() % 2000;
+    for (auto& m : mappings)
+    {
+      m = MappingResult{};
+      m.refSeqId = rng() % idManager.size();
+      offset_t refLen = idManager.getSequenceLength(m.refSeqId);
+      offset_t len = 1 + rng() % span;
+      m.queryStartPos = rng() % 4000;
+      m.queryEndPos = m.queryStartPos + len;
+      m.refStartPos = rng() % (refLen - len);
+      m.refEndPos = m.refStartPos + len;
+      if (rng() % 8 == 0)
+      {
+        //Mappings reaching the end of the reference sequence
+        m.refEndPos = refLen - 1;
+        m.refStartPos = refLen - 1 - len;
+      }
+      else if (rng() % 8 == 0)
+      {
+        //Mappings starting where the end events of those fall
+        m.refStartPos = 0;
+        m.refEndPos = len;
+      }
+      m.blockLength = (rng() % 5) * 100;
+      m.blockNucIdentity = (rng() % 4) * 0.05 + 0.8;
+      m.querySeqId = 0;
+      m.queryLen = 5000;
+      m.strand = strnd::FWD;
+    }
+    return mappings;
+  }
+
+  /**
+   * @brief   mappings of a wfmash -m PAF file, grouped by query
+   */
+  std::vector<MappingResultsVector_t> readPaf(const std::string& pafFile, const SequenceIdManager& idManager)
+  {
+    std::ifstream in(pafFile);
+    if (!in)
+    {
+      std::cerr << "[filter-equivalence] Error: cannot open " << pafFile << std::endl;
+      exit(1);
+    }
+    std::vector<MappingResultsVector_t> byQuery(idManager.size());
+    std::string line;
+    while (std::getline(in, line))
+    {
+      std::istringstream row(line);
+      std::string queryName, refName, strand, field;
+      MappingResult m{};
+      int mapq = 0;
+      row >> queryName >> m.queryLen >> m.queryStartPos >> m.queryEndPos >> strand
+          >> refName >> field >> m.refStartPos >> m.refEndPos >> m.conservedSketches >> m.blockLength >> mapq;
+      while (row >> field)
+      {
+        if (field.compare(0, 5, "id:f:") == 0)
+          m.blockNucIdentity = m.nucIdentity = std::stof(field.substr(5));
+      }
+      if (!row.eof() || m.blockLength <= 0)
+      {
+        std::cerr << "[filter-equivalence] Error: cannot parse PAF line: " << line << std::endl;
+        exit(1);
+      }
+      m.querySeqId = idManager.getSequenceId(queryName);
+      m.refSeqId = idManager.getSequenceId(refName);
+      m.strand = strand == "+" ? strnd::FWD : strnd::REV;
+      byQuery[m.querySeqId].push_back(m);
+    }
+    return byQuery;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    std::cerr << "Usage: filter-equivalence FASTA [PAF]" << std::endl;
+    return 1;
+  }
+  SequenceIdManager idManager({argv[1]}, {argv[1]}, {}, {}, "#");
+  const FilterSettings settings[] = {{0, false, 1.0}, {0, true, 0.5}, {1, false, 0.0}, {4, false, 0.5}, {4, true, 1.0}};
+  const size_t numSettings = sizeof(settings) / sizeof(settings[0]);
+
+  //Random mapping sets use one of the settings each, PAF queries all of them
+  std::mt19937_64 rng(7);
+  std::vector<MappingResultsVector_t> randomSets;
+  for (int t = 0; t < 5000; t++)
+    randomSets.push_back(randomMappings(rng, idManager));
+  std::vector<MappingResultsVector_t> pafQueries;
+  if (argc > 2)
+    pafQueries = readPaf(argv[2], idManager);
+
+  //Both query filter runs count two sweep events per mapping of a set of
+  //more than one mapping
+  auto events = [](const MappingResultsVector_t& mappings) {
+    return mappings.size() > 1 ? 4 * mappings.size() : 0;
+  };
+  uint64_t total = 0, pafMappings = 0;
+  for (const auto& mappings : randomSets)
+    total += events(mappings);
+  for (const auto& mappings : pafQueries)
+  {
+    pafMappings += mappings.size();
+    total += numSettings * events(mappings);
+  }
+  progress_meter::ProgressMeter progress(total, "[filter-equivalence] filtering");
+  TaskPool pool(4);
+
+  int differences = 0;
+  int runs = 0;
+  for (size_t t = 0; t < randomSets.size(); t++)
+  {
+    differences += compareFilters(randomSets[t], idManager, settings[t % numSettings], pool, progress);
+    runs += 3;
+  }
+  for (const auto& mappings : pafQueries)
+  {
+    for (const auto& s : settings)
+    {
+      differences += compareFilters(mappings, idManager, s, pool, progress);
+      runs += 3;
+    }
+  }
+  progress.finish();
+
+  std::cerr << "[filter-equivalence] " << runs << " filter runs (" << pafMappings << " PAF mappings), "
+            << differences << " differences" << std::endl;
+  return differences != 0;
+}